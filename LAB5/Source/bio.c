@@ -105,6 +105,14 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block without
+// reading it in, for a caller that overwrites all of it.
+struct buf*
+bgetnew(uint dev, uint blockno)
+{
+  return bget(dev, blockno);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
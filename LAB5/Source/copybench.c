@@ -0,0 +1,77 @@
+// Measure how fast the kernel copies to and from user memory.
+//   copybench [file] [rounds]
+// Pushes data through a pipe, and reads file (README by
+// default) again and again from the buffer cache, then prints
+// bytes per cycle for each.  Run it on kernels built before
+// and after a change to the copy routines to compare them.
+
+#include "types.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "user.h"
+#include "x86.h"
+
+static char buf[4096];
+
+// Print the rate of n bytes in cycles, to two decimal places.
+static void
+ratio(char *what, uint n, uint64 cycles)
+{
+  uint kc, x;
+
+  if((kc = (uint)(cycles >> 10)) == 0)
+    kc = 1;
+  // Bytes per Kcycle, then hundredths of a byte per cycle.
+  x = n / kc * 100 / 1024;
+  printf(1, "%s: %d bytes in %d Kcycles, %d.%d%d bytes/cycle\n",
+         what, n, kc, x / 100, x / 10 % 10, x % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *file;
+  int fd, p[2], rounds, r, n;
+  uint total;
+  uint64 t;
+
+  file = argc > 1 ? argv[1] : "README";
+  rounds = argc > 2 ? atoi(argv[2]) : 2000;
+
+  // A pipe holds 512 bytes, so write and read that much
+  // at a time without ever sleeping.
+  if(pipe(p) < 0){
+    printf(2, "copybench: pipe failed\n");
+    exit();
+  }
+  total = 0;
+  t = rdtsc();
+  for(r = 0; r < rounds; r++){
+    if(write(p[1], buf, 512) != 512 || read(p[0], buf, 512) != 512){
+      printf(2, "copybench: pipe i/o failed\n");
+      exit();
+    }
+    total += 512;
+  }
+  ratio("pipe", total, rdtsc() - t);
+  close(p[0]);
+  close(p[1]);
+
+  if((fd = open(file, O_RDONLY)) < 0){
+    printf(2, "copybench: cannot open %s\n", file);
+    exit();
+  }
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  total = 0;
+  t = rdtsc();
+  for(r = 0; r < rounds / 10; r++){
+    close(fd);
+    fd = open(file, O_RDONLY);
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      total += n;
+  }
+  ratio("read", total, rdtsc() - t);
+  close(fd);
+  exit();
+}
@@ -2,17 +2,22 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct memstat;
 struct pipe;
+struct pmemstat;
 struct proc;
 struct rtcdate;
+struct slabcache;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bgetnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 
@@ -24,6 +29,7 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -64,15 +70,31 @@ extern uchar    ioapicid;
 void            ioapicinit(void);
 
 // kalloc.c
-char*           kalloc(void);
+extern uint     phystop;
+char*           kalloc(int);
+char*           kalloc_zeroed(int);
+char*           kalloc_pages(int, int);
+void            kzeroidle(void);
 void            kfree(char*);
+void            kfree_pages(char*, int);
+void            ksplit_pages(char*, int);
+void            kdup(char*);
+int             krefcount(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+int             get_free_pages_count(void);
+void            getmemstat(struct memstat*);
 
 // kbd.c
 void            kbdintr(void);
 
+// ksm.c
+void            ksminit(void);
+char*           ksmmerge(char*);
+void            ksmstat(struct memstat*);
+
 // lapic.c
+uint            cmosmemkb(void);
 void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
@@ -87,6 +109,11 @@ void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
 
+// main.c
+extern uint64   boottsc;
+extern uint     bootkcycles;
+extern uint     kinit2kcycles;
+
 // mp.c
 extern int      ismp;
 void            mpinit(void);
@@ -95,7 +122,23 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// mmap.c
+int             mmap(struct file*, uint, uint, int, int);
+int             mmapfault(struct proc*, struct vma*, uint);
+void            mmapsync(pde_t*, struct vma*, uint, uint);
+int             msync(uint, uint);
+int             munmap(uint, uint);
+
+// pagecache.c
+void            pcinit(void);
+int             pccached(struct inode*, uint);
+char*           pcget(struct inode*, uint);
+int             pcread(struct inode*, uint, char*, uint);
+void            pcwrite(struct inode*, uint, char*, uint);
+void            pcinval(struct inode*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -106,10 +149,17 @@ int             pipewrite(struct pipe*, char*, int);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             vfork(void);
+void            vforkdone(struct proc*);
+int             spawn(char*, char**, int*);
 int             growproc(int);
+int             growlarge(int);
 int             kill(int);
-struct cpu*     mycpu(void);
-struct proc*    myproc();
+int             procmemstat(int, struct pmemstat*);
+int             getpids(int*, int);
+char*           swapvictim(int);
+void            ksmidle(void);
+struct cpu*     apiccpu(void);
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
@@ -122,7 +172,7 @@ void            wakeup(void*);
 void            yield(void);
 int             calculate_sum_of_digits(int);
 int             get_parent_pid(void);
-void            set_process_parent(int);
+int             set_process_parent(int);
 void            change_process_queue(int, int);
 void            set_hrrn_priority(int, int);
 void            set_ptable_hrrn_priority(int);
@@ -131,11 +181,23 @@ int             sem_init(int,int);
 int             sem_acquire(int);
 int             sem_release(int);
 
-void            get_free_pages_count(void);
-
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, int);
+int             shmat(int);
+int             shmdt(uint);
+void            shmdup(int);
+void            shmput(int);
+void            shmexit(int);
+
+// slab.c
+void            slabinit(struct slabcache*, char*, uint, int);
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -144,6 +206,8 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
+int             lockbench(int);
+int             lockstat(int, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -160,6 +224,21 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(int);
+int             swapout(void);
+int             swapin(int, char*);
+void            swapdup(int);
+void            swapput(int);
+void            swapstat(struct memstat*);
+
+// zswap.c
+void            zswapinit(void);
+int             zstore(int, char*);
+int             zload(int, char*);
+void            zfree(int);
+void            zswapstat(struct memstat*);
+
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
@@ -188,11 +267,28 @@ void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
+int             allocuvmlarge(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             cowpage(pde_t*, uint);
+int             uvmfault(struct proc*, uint, uint);
+int             uvmprefault(struct proc*, uint, uint);
+void            uvmpin(struct proc*, uint, uint);
+void            uvmunpin(struct proc*);
+void            uvmstat(pde_t*, uint, struct pmemstat*);
+char*           uvmevict(struct proc*, uint*, int);
+int             uvmmerge(struct proc*, uint*, int);
+struct vma*     vmalookup(struct proc*, uint);
+void            vmarelease(pde_t*, struct vma*);
+int             vmadup(struct proc*, struct proc*);
+uint            vmaspace(struct proc*, uint);
+void            vmatrim(struct vma*, uint);
+int             uvmshare(pde_t*, pde_t*, uint, uint);
+int             uvmcopy(pde_t*, pde_t*, uint, uint);
+char*           uvmdirty(pde_t*, uint);
+int             mappages(pde_t*, void*, uint, uint, int);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
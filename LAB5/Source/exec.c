@@ -9,6 +9,15 @@
 
 int
 exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
+
+// Load the program path into p, replacing the memory it
+// has, if any.  p is either the current process, or a new
+// one that spawn() is building.
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -16,8 +25,11 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], *v;
   pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+
+  memset(vma, 0, sizeof(vma));
+  v = vma;
 
   begin_op();
 
@@ -38,7 +50,9 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map the program.  Nothing is read yet: uvmfault() pages
+  // the file part of each segment in as it is touched, and
+  // zero-fills the rest like heap.
   sz = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -49,12 +63,23 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
+    if(ph.filesz == 0)
+      continue;
+    if(v == &vma[NVMA])
       goto bad;
+    v->type = VMA_FILE;
+    v->start = ph.vaddr;
+    v->end = PGROUNDUP(ph.vaddr + ph.filesz);
+    v->ip = idup(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    v++;
   }
   iunlockput(ip);
   end_op();
@@ -91,17 +116,28 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  curproc->q = 1;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  oldpgdir = p->pgdir;
+  p->pgdir = pgdir;
+  p->sz = sz;
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
+  p->q = 1;
+  if(p == myproc())
+    switchuvm(p);
+  if(p->lender){
+    // A vfork() child: the old memory was its parent's.
+    vforkdone(p);
+  } else if(oldpgdir){
+    vmarelease(oldpgdir, p->vma);
+    freevm(oldpgdir);
+  }
+  memmove(p->vma, vma, sizeof(vma));
+  if(p->pid == 1 && bootkcycles == 0)
+    // The first user instruction of init is next.
+    bootkcycles = (rdtsc() - boottsc) >> 10;
   return 0;
 
  bad:
@@ -111,5 +147,6 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  vmarelease(0, vma);
   return -1;
 }
@@ -14,6 +14,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;   // Next in icache hash chain
+  int npcache;        // Pages in the page cache
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -1,9 +1,58 @@
 #include "types.h"
 #include "stat.h"
+#include "param.h"
+#include "memstat.h"
 #include "user.h"
 
+static char *typename[NMEMTYPE] = {
+  [MEM_OTHER]   "other",
+  [MEM_PGTBL]   "page tables",
+  [MEM_KSTACK]  "kernel stacks",
+  [MEM_PIPE]    "pipes",
+  [MEM_USER]    "user",
+  [MEM_SLAB]    "slab caches",
+  [MEM_PCACHE]  "page cache",
+  [MEM_ZPOOL]   "compressed swap",
+};
+
 int main(int argc, char* argv[])
 {
-    get_free_pages_count();
+    struct memstat st;
+    int i, top;
+
+    if(get_mem_stats(&st) < 0){
+        printf(2, "gfpc: get_mem_stats failed\n");
+        exit();
+    }
+
+    printf(1, "We have %d free pages of %d\n", st.nfree, st.npages);
+    printf(1, "%d free pages are pre-zeroed\n", st.nzeroed);
+    for(i = 0; i < NMEMTYPE; i++)
+        printf(1, "%s: %d pages\n", typename[i], st.used[i]);
+    // Fragmentation: how the free pages are split into blocks.
+    top = -1;
+    for(i = 0; i <= MAXORDER; i++){
+        if(st.nblocks[i] > 0){
+            printf(1, "order %d: %d free blocks\n", i, st.nblocks[i]);
+            top = i;
+        }
+    }
+    printf(1, "largest free block: order %d\n", top);
+    printf(1, "swap: %d of %d pages used, %d out, %d in\n",
+           st.swapused, st.nswap, st.nswapout, st.nswapin);
+    printf(1, "compressed swap: %d pages in %d pool pages, %d went to disk\n",
+           st.zstored, st.zpoolpages, st.zrejected);
+    if(st.zstored > 0)
+        printf(1, "compressed to %d%% of original size\n",
+               st.zbytes / 41 / st.zstored);
+    printf(1, "swap-in: %d from pool, %d Kcycles each; %d from disk, %d Kcycles each\n",
+           st.nzswapin, st.zinkcycles, st.nswapin - st.nzswapin, st.diskinkcycles);
+    printf(1, "merged: %d shared pages, %d pages saved\n",
+           st.ksmpages, st.ksmsaved);
+    printf(1, "boot: %d Kcycles from main() to init, kinit2: %d pages in %d Kcycles\n",
+           st.bootkcycles, st.kinit2pages, st.kinit2kcycles);
+    for(i = 0; i < st.ncpu; i++)
+        printf(1, "cpu%d: %d cached, %d hits, %d misses\n",
+               i, st.cached[i], st.hit[i], st.miss[i]);
     exit();
-}
\ No newline at end of file
+}
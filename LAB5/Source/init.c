@@ -22,9 +22,10 @@ main(void)
   for(;;){
     printf(1, "init: starting sh\n");
     printf(1, "Morteza Nouri, Shayan Shahmohammadi, Seyed Mohammad Amin Atyabi\n");
-    pid = fork();
+    // The child only execs sh, so there is no need to copy init.
+    pid = vfork();
     if(pid < 0){
-      printf(1, "init: fork failed\n");
+      printf(1, "init: vfork failed\n");
       exit();
     }
     if(pid == 0){
@@ -1,111 +1,655 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and
+// physically contiguous blocks of 2^order pages.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "x86.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "memstat.h"
 
 void freerange(void *vstart, void *vend);
-extern char end[]; // first address after kernel loaded from ELF file
-                   // defined by the kernel linker script in kernel.ld
+static void freepage(char *v);
 
+// Free blocks are kept on doubly linked lists so that a
+// block can be unlinked when its buddy is freed.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+// Binary buddy allocator.  A free block of order k is 2^k
+// pages whose page frame number is a multiple of 2^k; its
+// buddy is the block whose pfn differs only in bit k.  When
+// both are free they merge into one block of order k+1.
+// Counters are kept up to date as blocks move, so reading
+// them never has to walk a free list.
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[MAXORDER+1];  // Free blocks of each order
+  uint nblocks[MAXORDER+1];      // Length of each free list
+  uint nfree;            // Pages on the free lists
+  uint npages;           // Pages ever given to the allocator
+  int used[NMEMTYPE];    // In-use pages, other than in kcache
 } kmem;
 
+// Per-page metadata, indexed by page frame number.
+struct page {
+  uint ref;      // Mappings and kernel pointers to an in-use page
+  uchar type;    // MEM_ type the page was last allocated as
+  uchar order;   // Order of the free block this page heads
+  uchar flags;
+};
+#define PG_FREE 0x1      // Head of a block on a kmem free list
+
+// Carved out of the memory after end by kinit1(), since
+// its size depends on the amount of memory.
+static struct page *pages;
+static uint npage;
+static char *pagesend;
+#define PFN(v) (V2P(v) / PGSIZE)
+#define PGTYPE(v) pages[PFN(v)].type
+#define PGREF(v) pages[PFN(v)].ref
+
+// Per-CPU magazines of free pages.  kalloc() and kfree()
+// work on the local magazine with only interrupts disabled
+// and go to kmem in batches: refilling when it is empty and
+// draining when it is full.  A page freed on a different CPU
+// than it was allocated on simply joins that CPU's magazine.
+// When kmem runs dry, kcacheflush() empties every magazine
+// into it, so each magazine's lists are also guarded by a
+// word lock that its owner almost always finds free.
+// Lock order: a magazine's lock, then kmem.lock.
+#define KCACHEMAX   64  // pages a magazine may hold
+#define KCACHEBATCH 32  // pages moved per refill or drain
+#define KZEROMAX    32  // pre-zeroed pages kept per CPU
+
+struct kcache {
+  uint lock;
+  struct run *freelist;
+  int nfree;
+  struct run *zeroed;  // Free pages already filled with zeros
+  int nzeroed;
+  uint hit;    // kalloc() served from the magazine
+  uint miss;   // kalloc() had to refill from kmem
+  int used[NMEMTYPE];  // Pages allocated minus pages freed here
+} __attribute__((aligned(CACHELINE)));
+
+static struct kcache kcache[NCPU];
+static void kcachedrain(struct kcache*);
+
+// Called with interrupts off.
+static void
+kclock(struct kcache *kc)
+{
+  while(xchg(&kc->lock, 1) != 0)
+    pause();
+}
+
+static void
+kcunlock(struct kcache *kc)
+{
+  xchg(&kc->lock, 0);
+}
+
+// Put the block at pfn on the order-k free list.
+static void
+buddypush(uint pfn, int k)
+{
+  struct run *r;
+
+  r = (struct run*)P2V(pfn * PGSIZE);
+  r->prev = 0;
+  r->next = kmem.free[k];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[k] = r;
+  kmem.nblocks[k]++;
+  pages[pfn].order = k;
+  pages[pfn].flags |= PG_FREE;
+}
+
+// Take the block at pfn off the order-k free list.
+static void
+buddyunlink(uint pfn, int k)
+{
+  struct run *r;
+
+  r = (struct run*)P2V(pfn * PGSIZE);
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nblocks[k]--;
+  pages[pfn].flags &= ~PG_FREE;
+}
+
+// Free the order-k block at v, merging it with its buddy
+// for as long as the buddy is free too.
+// Caller holds kmem.lock (or runs before kinit2()).
+static void
+buddyfree(char *v, int k)
+{
+  uint pfn, buddy;
+
+  pfn = PFN(v);
+  kmem.nfree += 1 << k;
+  for(; k < MAXORDER; k++){
+    buddy = pfn ^ (1 << k);
+    if(buddy >= npage || !(pages[buddy].flags & PG_FREE) ||
+       pages[buddy].order != k)
+      break;
+    buddyunlink(buddy, k);
+    pfn &= ~(1 << k);
+  }
+  buddypush(pfn, k);
+}
+
+// Allocate an order-k block, splitting a larger one if
+// there is no free block of exactly that order.
+// Caller holds kmem.lock (or runs before kinit2()).
+static char*
+buddyalloc(int k)
+{
+  uint pfn;
+  int j;
+
+  for(j = k; j <= MAXORDER && kmem.free[j] == 0; j++)
+    ;
+  if(j > MAXORDER)
+    return 0;
+  pfn = PFN(kmem.free[j]);
+  buddyunlink(pfn, j);
+  // Give back the upper half until the block is small enough.
+  while(j > k){
+    j--;
+    buddypush(pfn + (1 << j), j);
+  }
+  kmem.nfree -= 1 << k;
+  return P2V(pfn * PGSIZE);
+}
+
+uint phystop;  // Top of physical memory
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// kinit1() also sizes memory, and puts pages[] at vstart.
 void
 kinit1(void *vstart, void *vend)
 {
+  uint kb;
+
   initlock(&kmem.lock, "kmem");
   kmem.use_lock = 0;
-  freerange(vstart, vend);
+  kb = cmosmemkb();
+  if(kb > MAXPHYS / 1024)
+    kb = MAXPHYS / 1024;
+  phystop = PGROUNDDOWN(kb * 1024);
+  if(phystop < ENTRYMEM)
+    panic("kinit1: not enough memory");
+  npage = phystop / PGSIZE;
+  pages = (struct page*)PGROUNDUP((uint)vstart);
+  pagesend = (char*)(pages + npage);
+  // Only the part below vend is mapped yet.
+  memset(pages, 0, (pagesend < (char*)vend ? pagesend : (char*)vend) - (char*)pages);
+  freerange(pagesend, vend);
 }
 
 void
 kinit2(void *vstart, void *vend)
 {
+  if(pagesend > (char*)vstart){
+    memset(vstart, 0, pagesend - (char*)vstart);
+    vstart = pagesend;
+  }
   freerange(vstart, vend);
   kmem.use_lock = 1;
 }
 
+// Give [vstart, vend) to the buddy lists as the largest
+// aligned blocks that fit.  Only the first page of each
+// block is written now; the rest of memory is first touched
+// when a block is split up to be allocated.
 void
 freerange(void *vstart, void *vend)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
-    kfree(p);
+  uint pfn, epfn;
+  int k;
+
+  pfn = PFN(PGROUNDUP((uint)vstart));
+  epfn = V2P(vend) / PGSIZE;
+  while(pfn < epfn){
+    for(k = MAXORDER; k > 0; k--)
+      if((pfn & ((1 << k) - 1)) == 0 && pfn + (1 << k) <= epfn)
+        break;
+#ifdef KALLOC_DEBUG
+    memset(P2V(pfn * PGSIZE), 1, PGSIZE << k);
+#endif
+    buddyfree(P2V(pfn * PGSIZE), k);
+    kmem.npages += 1 << k;
+    pfn += 1 << k;
+  }
 }
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, which must have been returned by a call to
+// kalloc(), and free it if that was the last one.
 void
 kfree(char *v)
 {
-  struct run *r;
+  uint ref;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < pagesend || V2P(v) >= phystop)
     panic("kfree");
+  if((ref = fetchadd(&PGREF(v), -1)) == 0)
+    panic("kfree: ref");
+  if(ref > 1)
+    return;
 
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
+
+  freepage(v);
+}
+
+// Put the allocated page v on a free list, taking it off
+// the in-use count of its type.
+static void
+freepage(char *v)
+{
+  struct run *r;
+  struct kcache *kc;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  // Before kinit2() there are no other CPUs and no %gs yet.
+  if(!kmem.use_lock){
+    kmem.used[PGTYPE(v)]--;
+    buddyfree(v, 0);
+    return;
+  }
+
+  pushcli();
+  kc = &kcache[cpuid()];
+  kc->used[PGTYPE(v)]--;
+  kclock(kc);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  if(++kc->nfree > KCACHEMAX)
+    kcachedrain(kc);
+  kcunlock(kc);
+  popcli();
+}
+
+// Move KCACHEBATCH pages from kc back to kmem.
+// Caller holds kc's lock.
+static void
+kcachedrain(struct kcache *kc)
+{
+  struct run *r;
+  int n;
+
+  acquire(&kmem.lock);
+  for(n = 0; n < KCACHEBATCH && (r = kc->freelist) != 0; n++){
+    kc->freelist = r->next;
+    buddyfree((char*)r, 0);
+  }
+  release(&kmem.lock);
+  kc->nfree -= n;
+}
+
+// Move up to KCACHEBATCH pages from kmem into kc.
+// Caller holds kc's lock.
+static void
+kcacherefill(struct kcache *kc)
+{
+  struct run *r;
+  int n;
+
+  acquire(&kmem.lock);
+  for(n = 0; n < KCACHEBATCH && (r = (struct run*)buddyalloc(0)) != 0; n++){
+    r->next = kc->freelist;
+    kc->freelist = r;
+  }
+  release(&kmem.lock);
+  kc->nfree += n;
+}
+
+// Give back the pages of every CPU's magazine and zeroed
+// pool to kmem, where they can merge into larger blocks.
+// Caller must not hold a magazine's lock.
+static void
+kcacheflush(void)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  pushcli();
+  for(kc = kcache; kc < &kcache[ncpu]; kc++){
+    kclock(kc);
+    acquire(&kmem.lock);
+    while((r = kc->freelist) != 0){
+      kc->freelist = r->next;
+      buddyfree((char*)r, 0);
+    }
+    while((r = kc->zeroed) != 0){
+      kc->zeroed = r->next;
+      buddyfree((char*)r, 0);
+    }
     release(&kmem.lock);
+    kc->nfree = 0;
+    kc->nzeroed = 0;
+    kcunlock(kc);
+  }
+  popcli();
 }
 
-// Allocate one 4096-byte page of physical memory.
+// Take a page off kc's lists, preferring a dirty one.
+// Caller holds kc's lock.
+static struct run*
+kcachepop(struct kcache *kc)
+{
+  struct run *r;
+
+  if((r = kc->freelist) != 0){
+    kc->freelist = r->next;
+    kc->nfree--;
+  } else if((r = kc->zeroed) != 0){
+    // Out of dirty pages; a zeroed one will do.
+    kc->zeroed = r->next;
+    kc->nzeroed--;
+  }
+  return r;
+}
+
+static char *kalloc1(int);
+
+// Allocate one 4096-byte page of physical memory,
+// charged to type (one of the MEM_ constants in memstat.h).
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// A caller that may sleep gets pages swapped out to make
+// room before being told so.
 char*
-kalloc(void)
+kalloc(int type)
+{
+  char *r;
+
+  while((r = kalloc1(type)) == 0 && (readeflags() & FL_IF) &&
+        myproc() && swapout() == 0)
+    ;
+  return r;
+}
+
+static char*
+kalloc1(int type)
 {
   struct run *r;
+  struct kcache *kc;
+
+  if(!kmem.use_lock){
+    r = (struct run*)buddyalloc(0);
+    if(r){
+      kmem.used[type]++;
+      PGTYPE(r) = type;
+      PGREF(r) = 1;
+    }
+    return (char*)r;
+  }
+
+  pushcli();
+  kc = &kcache[cpuid()];
+  kclock(kc);
+  if(kc->freelist){
+    kc->hit++;
+  } else {
+    kc->miss++;
+    kcacherefill(kc);
+  }
+  r = kcachepop(kc);
+  kcunlock(kc);
+  if(r == 0){
+    // Other CPUs may still hold free pages.
+    kcacheflush();
+    kclock(kc);
+    kcacherefill(kc);
+    r = kcachepop(kc);
+    kcunlock(kc);
+  }
+  if(r){
+    kc->used[type]++;
+    PGTYPE(r) = type;
+    PGREF(r) = 1;
+  }
+  popcli();
+  return (char*)r;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size, charged to type.  Order 0 is the same as
+// kalloc().  Returns 0 if no free block is large enough.
+char*
+kalloc_pages(int order, int type)
+{
+  char *v;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc(type);
+
+  if(kmem.use_lock){
+    acquire(&kmem.lock);
+    if((v = buddyalloc(order)) == 0){
+      // Pages parked in the magazines can't merge; give
+      // them back and try once more.
+      release(&kmem.lock);
+      kcacheflush();
+      acquire(&kmem.lock);
+      v = buddyalloc(order);
+    }
+  } else {
+    v = buddyalloc(order);
+  }
+  if(v){
+    kmem.used[type] += 1 << order;
+    PGTYPE(v) = type;
+    PGREF(v) = 1;
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  return v;
+}
+
+// Turn the block v returned by kalloc_pages(order, ...) into
+// 2^order pages that are each freed with kfree().
+void
+ksplit_pages(char *v, int order)
+{
+  int i;
+
+  for(i = 1; i < (1 << order); i++){
+    PGTYPE(v + i*PGSIZE) = PGTYPE(v);
+    PGREF(v + i*PGSIZE) = 1;
+  }
+}
+
+// Take another reference to the in-use page v, which
+// kfree() will then have to drop as well.
+void
+kdup(char *v)
+{
+  if(fetchadd(&PGREF(v), 1) == 0)
+    panic("kdup");
+}
+
+// Number of references to the in-use page v.
+int
+krefcount(char *v)
+{
+  return PGREF(v);
+}
+
+// Free a block returned by kalloc_pages(order, ...).
+void
+kfree_pages(char *v, int order)
+{
+  if(order < 0 || order > MAXORDER)
+    panic("kfree_pages: order");
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if(PFN(v) & ((1 << order) - 1) || v < pagesend ||
+     V2P(v) + (PGSIZE << order) > phystop)
+    panic("kfree_pages");
+  if(fetchadd(&PGREF(v), -1) != 1)
+    panic("kfree_pages: ref");
+
+#ifdef KALLOC_DEBUG
+  memset(v, 1, PGSIZE << order);
+#endif
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  kmem.used[PGTYPE(v)] -= 1 << order;
+  buddyfree(v, order);
   if(kmem.use_lock)
     release(&kmem.lock);
+}
+
+// Like kalloc(), but the page is filled with zeros.
+// Takes a page zeroed ahead of time by kzeroidle() if
+// this CPU has one, and only zeroes it here otherwise.
+char*
+kalloc_zeroed(int type)
+{
+  struct run *r;
+  struct kcache *kc;
+
+  r = 0;
+  if(kmem.use_lock){
+    pushcli();
+    kc = &kcache[cpuid()];
+    kclock(kc);
+    if((r = kc->zeroed) != 0){
+      kc->zeroed = r->next;
+      kc->nzeroed--;
+    }
+    kcunlock(kc);
+    if(r){
+      kc->hit++;
+      kc->used[type]++;
+      PGTYPE(r) = type;
+      PGREF(r) = 1;
+    }
+    popcli();
+  }
+  if(r){
+    r->next = 0;
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc(type)) != 0)
+    memset(r, 0, PGSIZE);
   return (char*)r;
 }
 
-void get_free_pages_count(void)
+// Called by the scheduler when this CPU has nothing to run.
+// Zero one free page into the CPU's pool, so that page
+// table and user page allocation can skip the memset.
+void
+kzeroidle(void)
 {
   struct run *r;
-  int count = 0;
-  
-  r = kmem.freelist;
-  while(r) {
-    count++;
-    r = r->next;
+  struct kcache *kc;
+
+  if(!kmem.use_lock)
+    return;
+  pushcli();
+  kc = &kcache[cpuid()];
+  if(kc->nzeroed >= KZEROMAX){
+    popcli();
+    return;
+  }
+  kclock(kc);
+  if(kc->freelist == 0)
+    kcacherefill(kc);
+  if((r = kc->freelist) != 0){
+    kc->freelist = r->next;
+    kc->nfree--;
   }
+  kcunlock(kc);
+  popcli();
+  if(r == 0)
+    return;
 
-  cprintf("We have %d free pages\n", count);
+  // The page belongs to no list now; zero it with
+  // interrupts on.  The scheduler doesn't migrate, so
+  // this is still the same CPU afterwards.
+  memset(r, 0, PGSIZE);
+
+  pushcli();
+  kclock(kc);
+  r->next = kc->zeroed;
+  kc->zeroed = r;
+  kc->nzeroed++;
+  kcunlock(kc);
+  popcli();
 }
 
+// Number of free pages.  The per-CPU counts are read
+// without their owners' cooperation, so this is a snapshot.
+int
+get_free_pages_count(void)
+{
+  struct kcache *kc;
+  int count;
 
+  count = kmem.nfree;
+  for(kc = kcache; kc < &kcache[ncpu]; kc++)
+    count += kc->nfree + kc->nzeroed;
+  return count;
+}
+
+void
+getmemstat(struct memstat *st)
+{
+  struct kcache *kc;
+  int i, t, used;
+
+  memset(st, 0, sizeof(*st));
+  st->npages = kmem.npages;
+  st->nfree = get_free_pages_count();
+  for(t = 0; t < NMEMTYPE; t++){
+    used = kmem.used[t];
+    for(kc = kcache; kc < &kcache[ncpu]; kc++)
+      used += kc->used[t];
+    st->used[t] = used;
+  }
+  for(i = 0; i <= MAXORDER; i++)
+    st->nblocks[i] = kmem.nblocks[i];
+  swapstat(st);
+  ksmstat(st);
+  st->bootkcycles = bootkcycles;
+  st->kinit2pages = (phystop - ENTRYMEM) / PGSIZE;
+  st->kinit2kcycles = kinit2kcycles;
+  st->ncpu = ncpu;
+  for(i = 0; i < ncpu; i++){
+    st->nzeroed += kcache[i].nzeroed;
+    st->cached[i] = kcache[i].nfree;
+    st->hit[i] = kcache[i].hit;
+    st->miss[i] = kcache[i].miss;
+  }
+}
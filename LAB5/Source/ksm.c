@@ -0,0 +1,144 @@
+// Same-page merging.
+//
+// When a CPU is idle, ksmidle() offers the user pages of
+// processes that are not running to ksmmerge(), a few at a
+// time.  A page whose contents match a page in the stable
+// table is replaced by that page, mapped copy-on-write; the
+// duplicate is freed.  A page whose hash has been seen
+// before, but isn't in the table yet, becomes a stable page
+// itself.  The table keeps a reference to each stable page,
+// so the page stays read-only for everyone mapping it, and
+// lets go of it once no one else does.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "memstat.h"
+
+#define NKSMHASH 256
+#define NSEEN 1024
+#define KSMGC 4      // Stable pages checked per ksmmerge()
+
+struct ksmpage {
+  uint hash;
+  char *page;              // 0 if the entry is free
+  struct ksmpage *next;    // Hash chain, or free list
+};
+
+struct {
+  struct spinlock lock;
+  struct ksmpage pages[NKSM];
+  struct ksmpage *hash[NKSMHASH];
+  struct ksmpage *free;
+  uint seen[NSEEN];        // Hashes of pages scanned before
+  int gc;                  // Next entry ksmgc() looks at
+} ksm;
+
+void
+ksminit(void)
+{
+  struct ksmpage *k;
+
+  initlock(&ksm.lock, "ksm");
+  for(k = ksm.pages; k < &ksm.pages[NKSM]; k++){
+    k->next = ksm.free;
+    ksm.free = k;
+  }
+}
+
+static uint
+pagehash(char *pg)
+{
+  uint *w, h;
+
+  h = 2166136261;
+  for(w = (uint*)pg; w < (uint*)(pg + PGSIZE); w++)
+    h = (h ^ *w) * 16777619;
+  return h;
+}
+
+// Free stable pages that only the table still holds.
+// Caller holds ksm.lock.
+static void
+ksmgc(void)
+{
+  struct ksmpage *k, **pp;
+  int i;
+
+  for(i = 0; i < KSMGC; i++){
+    k = &ksm.pages[ksm.gc];
+    ksm.gc = (ksm.gc + 1) % NKSM;
+    if(k->page == 0 || krefcount(k->page) > 1)
+      continue;
+    for(pp = &ksm.hash[k->hash % NKSMHASH]; *pp != k; pp = &(*pp)->next)
+      ;
+    *pp = k->next;
+    kfree(k->page);
+    k->page = 0;
+    k->next = ksm.free;
+    ksm.free = k;
+  }
+}
+
+// Offer the user page pg, mapped by a process that is not
+// running, for merging.  Returns the page to map instead,
+// read-only and copy-on-write, with a reference for the
+// mapping; this may be pg itself, if it just became a
+// stable page.  Returns 0 to leave the mapping alone.
+char*
+ksmmerge(char *pg)
+{
+  struct ksmpage *k;
+  uint h;
+
+  h = pagehash(pg);
+  acquire(&ksm.lock);
+  ksmgc();
+  for(k = ksm.hash[h % NKSMHASH]; k; k = k->next){
+    if(k->hash != h || memcmp(k->page, pg, PGSIZE) != 0)
+      continue;
+    if(k->page == pg)
+      break;
+    kdup(k->page);
+    release(&ksm.lock);
+    return k->page;
+  }
+  if(k != 0 || ksm.seen[h % NSEEN] != h || ksm.free == 0){
+    ksm.seen[h % NSEEN] = h;
+    release(&ksm.lock);
+    return 0;
+  }
+  // Second page with this hash: keep it.
+  k = ksm.free;
+  ksm.free = k->next;
+  k->hash = h;
+  k->page = pg;
+  k->next = ksm.hash[h % NKSMHASH];
+  ksm.hash[h % NKSMHASH] = k;
+  kdup(pg);
+  kdup(pg);
+  release(&ksm.lock);
+  return pg;
+}
+
+void
+ksmstat(struct memstat *st)
+{
+  struct ksmpage *k;
+  int ref;
+
+  acquire(&ksm.lock);
+  st->ksmpages = 0;
+  st->ksmsaved = 0;
+  for(k = ksm.pages; k < &ksm.pages[NKSM]; k++){
+    if(k->page == 0)
+      continue;
+    st->ksmpages++;
+    // One reference is the table's, one the original's.
+    if((ref = krefcount(k->page)) > 2)
+      st->ksmsaved += ref - 2;
+  }
+  release(&ksm.lock);
+}
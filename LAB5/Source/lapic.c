@@ -180,6 +180,26 @@ cmos_read(uint reg)
   return inb(CMOS_RETURN);
 }
 
+#define CMOS_EXTLO   0x30  // Memory above 1MB, in KB
+#define CMOS_EXTHI   0x31
+#define CMOS_EXT16LO 0x34  // Memory above 16MB, in 64KB units
+#define CMOS_EXT16HI 0x35
+
+// Size of physical memory in KB, as the BIOS left it in
+// the CMOS.  The E820 map would be better, but only
+// real-mode code can ask for it.
+uint
+cmosmemkb(void)
+{
+  uint n;
+
+  n = cmos_read(CMOS_EXT16LO) | (cmos_read(CMOS_EXT16HI) << 8);
+  if(n > 0)
+    return 16*1024 + n*64;
+  n = cmos_read(CMOS_EXTLO) | (cmos_read(CMOS_EXTHI) << 8);
+  return 1024 + n;
+}
+
 static void
 fill_rtcdate(struct rtcdate *r)
 {
@@ -0,0 +1,64 @@
+// Spinlock microbenchmark.
+// Runs nproc processes that all hammer the same kernel lock
+// for nticks clock ticks, then prints the acquisitions each
+// one got.  Run with nproc equal to CPUS to see throughput
+// and fairness as the CPU count grows.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define MAXPROC 16
+
+int
+main(int argc, char *argv[])
+{
+  int nproc, nticks, i, n, fd[2];
+  int counts[MAXPROC];
+  uint total, min, max;
+
+  nproc = argc > 1 ? atoi(argv[1]) : 2;
+  nticks = argc > 2 ? atoi(argv[2]) : 100;
+  if(nproc < 1 || nproc > MAXPROC || nticks < 1){
+    printf(2, "usage: lockbench [nproc] [nticks]\n");
+    exit();
+  }
+
+  if(pipe(fd) < 0){
+    printf(2, "lockbench: pipe failed\n");
+    exit();
+  }
+
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0){
+      close(fd[0]);
+      n = lockbench(nticks);
+      write(fd[1], &n, sizeof(n));
+      exit();
+    }
+  }
+  close(fd[1]);
+
+  for(i = 0; i < nproc; i++)
+    if(read(fd[0], &counts[i], sizeof(counts[i])) != sizeof(counts[i]))
+      counts[i] = 0;
+  for(i = 0; i < nproc; i++)
+    wait();
+  close(fd[0]);
+
+  total = 0;
+  min = max = counts[0];
+  for(i = 0; i < nproc; i++){
+    printf(1, "proc %d: %d acquisitions\n", i, counts[i]);
+    total += counts[i];
+    if(counts[i] < min)
+      min = counts[i];
+    if(counts[i] > max)
+      max = counts[i];
+  }
+  printf(1, "total %d acquisitions in %d ticks (%d per tick)\n",
+         total, nticks, total / nticks);
+  if(max > 0)
+    printf(1, "fairness (min/max) %d%%\n", min * 100 / max);
+  exit();
+}
@@ -0,0 +1,25 @@
+// Print or reset kernel lock contention statistics.
+// Needs a kernel built with make LOCKSTAT=1.
+//   lockstat [n]   print the n most contended locks (default 10)
+//   lockstat -r    reset all counters
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+
+  if(argc > 1 && strcmp(argv[1], "-r") == 0){
+    if(lockstat(0, 1) < 0)
+      printf(2, "lockstat: kernel built without LOCKSTAT\n");
+    exit();
+  }
+
+  n = argc > 1 ? atoi(argv[1]) : 10;
+  if(lockstat(n, 0) < 0)
+    printf(2, "lockstat: kernel built without LOCKSTAT\n");
+  exit();
+}
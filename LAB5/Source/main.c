@@ -5,6 +5,11 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "memstat.h"
+
+uint64 boottsc;      // Time stamp when main() started
+uint bootkcycles;    // Kcycles from main() to init's first instruction
+uint kinit2kcycles;  // Kcycles kinit2() took
 
 static void startothers(void);
 static void mpmain(void)  __attribute__((noreturn));
@@ -17,7 +22,10 @@ extern char end[]; // first address after kernel loaded from ELF file
 int
 main(void)
 {
-  kinit1(end, P2V(4*1024*1024)); // phys page allocator
+  uint64 t;
+
+  boottsc = rdtsc();
+  kinit1(end, P2V(ENTRYMEM)); // phys page allocator
   kvmalloc();      // kernel page table
   mpinit();        // detect other processors
   lapicinit();     // interrupt controller
@@ -30,9 +38,16 @@ main(void)
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  pipeinit();      // pipe cache
+  shminit();       // shared memory segments
+  pcinit();        // page cache
+  ksminit();       // same-page merging
+  zswapinit();     // compressed swap pool
   ideinit();       // disk 
   startothers();   // start other processors
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  t = rdtsc();
+  kinit2(P2V(ENTRYMEM), P2V(phystop)); // must come after startothers()
+  kinit2kcycles = (rdtsc() - t) >> 10;
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -81,7 +96,7 @@ startothers(void)
     // Tell entryother.S what stack to use, where to enter, and what
     // pgdir to use. We cannot use kpgdir yet, because the AP processor
     // is running in low  memory, so we use entrypgdir for the APs too.
-    stack = kalloc();
+    stack = kalloc(MEM_KSTACK);
     *(void**)(code-4) = stack + KSTACKSIZE;
     *(void(**)(void))(code-8) = mpenter;
     *(int**)(code-12) = (void *) V2P(entrypgdir);
@@ -101,10 +116,12 @@ startothers(void)
 
 __attribute__((__aligned__(PGSIZE)))
 pde_t entrypgdir[NPDENTRIES] = {
-  // Map VA's [0, 4MB) to PA's [0, 4MB)
+  // Map VA's [0, 8MB) to PA's [0, 8MB)
   [0] = (0) | PTE_P | PTE_W | PTE_PS,
-  // Map VA's [KERNBASE, KERNBASE+4MB) to PA's [0, 4MB)
+  [1] = (0x400000) | PTE_P | PTE_W | PTE_PS,
+  // Map VA's [KERNBASE, KERNBASE+8MB) to PA's [0, 8MB)
   [KERNBASE>>PDXSHIFT] = (0) | PTE_P | PTE_W | PTE_PS,
+  [(KERNBASE>>PDXSHIFT)+1] = (0x400000) | PTE_P | PTE_W | PTE_PS,
 };
 
 //PAGEBREAK!
@@ -0,0 +1,41 @@
+// Physical memory statistics, filled in by get_mem_stats().
+// Include param.h first for NCPU and MAXORDER.
+
+// What a page was allocated for (see kalloc).
+#define MEM_OTHER   0   // Anything else
+#define MEM_PGTBL   1   // Page directories and page tables
+#define MEM_KSTACK  2   // Kernel stacks
+#define MEM_PIPE    3   // Pipe buffers
+#define MEM_USER    4   // User memory
+#define MEM_SLAB    5   // Slab caches of small objects
+#define MEM_PCACHE  6   // Page cache of file data
+#define MEM_ZPOOL   7   // Compressed swap pool
+#define NMEMTYPE    8
+
+struct memstat {
+  uint npages;          // Pages managed by the allocator
+  uint nfree;           // Free pages, including per-CPU caches
+  uint nzeroed;         // Free pages that are already zeroed
+  uint used[NMEMTYPE];  // Pages in use, by MEM_ type
+  uint nblocks[MAXORDER+1];  // Free buddy blocks of each order
+  uint nswap;           // Pages the swap area holds
+  uint swapused;        // Swap slots in use
+  uint nswapout;        // Pages written out to swap so far
+  uint nswapin;         // Pages read back in from swap so far
+  uint nzswapin;        // ... of which from the compressed pool
+  uint zinkcycles;      // Average Kcycles to swap in from the pool
+  uint diskinkcycles;   // ... and from disk
+  uint zpoolpages;      // Pages in the compressed pool
+  uint zstored;         // Swapped-out pages kept in the pool
+  uint zbytes;          // Their compressed size
+  uint zrejected;       // Pages that went to disk instead
+  uint ksmpages;        // Pages shared by same-page merging
+  uint ksmsaved;        // Pages freed by merging into them
+  uint bootkcycles;     // Kcycles from main() to starting init
+  uint kinit2pages;     // Pages kinit2() freed at boot
+  uint kinit2kcycles;   // ... and the Kcycles that took
+  uint ncpu;            // Number of valid entries below
+  uint cached[NCPU];    // Free pages in each CPU's cache
+  uint hit[NCPU];       // kalloc() served from the CPU's cache
+  uint miss[NCPU];      // kalloc() that had to refill the cache
+};
@@ -0,0 +1,7 @@
+// mmap() protection and flags.
+
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+#define MAP_SHARED  0x1   // Stores go to the file
+#define MAP_PRIVATE 0x2   // Stores go to a private copy
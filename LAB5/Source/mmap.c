@@ -0,0 +1,164 @@
+// Memory-mapped files.
+//
+// mmap() records a VMA_MMAP mapping above MMAPBASE and maps
+// nothing yet.  The first touch of each page faults it in
+// from the page cache (pagecache.c).  A shared mapping maps
+// the cached page itself, so all sharers and read() and
+// write() see the same data; a private mapping maps it
+// copy-on-write.  Dirty pages of shared mappings are written
+// back to the file by msync(), munmap(), exit and exec.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+
+// Map len bytes of f starting at file offset off into the
+// current process.  Returns the address, or -1.
+int
+mmap(struct file *f, uint off, uint len, int prot, int flags)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+  uint va;
+
+  if(f->type != FD_INODE || len == 0 || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(!f->readable || ((prot & PROT_WRITE) && flags == MAP_SHARED && !f->writable))
+    return -1;
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++)
+    if(v->type == 0)
+      break;
+  if(v == &curproc->vma[NVMA])
+    return -1;
+  len = PGROUNDUP(len);
+  if(len == 0 || (va = vmaspace(curproc, len)) == 0)
+    return -1;
+
+  v->type = VMA_MMAP;
+  v->start = va;
+  v->end = va + len;
+  v->ip = idup(f->ip);
+  v->off = off;
+  v->prot = prot;
+  v->flags = flags;
+  return va;
+}
+
+// Fault in the page at va of mapping v in process p.
+// Sleeps, so the caller must not hold a spinlock.
+int
+mmapfault(struct proc *p, struct vma *v, uint va)
+{
+  char *pg;
+  int perm, cached;
+  uint pgoff;
+
+  if(mycpu()->ncli > 0)
+    return -1;
+  pgoff = (v->off + va - v->start) / PGSIZE;
+  ilock(v->ip);
+  cached = pccached(v->ip, pgoff);
+  pg = pcget(v->ip, pgoff);
+  iunlock(v->ip);
+  if(pg == 0)
+    return -1;  // Past the end of the file
+
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= v->flags == MAP_SHARED ? PTE_W : PTE_COW;
+  // The mapping takes over pcget()'s reference.
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(pg), perm) < 0){
+    kfree(pg);
+    return -1;
+  }
+  if(cached)
+    p->nminflt++;
+  else
+    p->nmajflt++;
+  return 0;
+}
+
+// Write the dirty pages of [start, end) in shared mapping v
+// back to its file.  Doesn't extend the file.
+void
+mmapsync(pde_t *pgdir, struct vma *v, uint start, uint end)
+{
+  // As in filewrite(), keep each transaction small.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+  uint a, off, n, i;
+  char *pg;
+
+  if(v->flags != MAP_SHARED || !(v->prot & PROT_WRITE))
+    return;
+  for(a = PGROUNDDOWN(start); a < end; a += PGSIZE){
+    if((pg = uvmdirty(pgdir, a)) == 0)
+      continue;
+    off = v->off + a - v->start;
+    for(i = 0; i < PGSIZE; i += n){
+      begin_op();
+      ilock(v->ip);
+      n = 0;
+      if(off + i < v->ip->size){
+        n = v->ip->size - off - i;
+        if(n > PGSIZE - i)
+          n = PGSIZE - i;
+        if(n > max)
+          n = max;
+        writei(v->ip, pg + i, off + i, n);
+      }
+      iunlock(v->ip);
+      end_op();
+      if(n == 0)
+        break;
+    }
+    kfree(pg);
+  }
+}
+
+// Write back dirty pages in [addr, addr+len) of the current
+// process's shared mappings.
+int
+msync(uint addr, uint len)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+
+  if((v = vmalookup(curproc, addr)) == 0 || v->type != VMA_MMAP)
+    return -1;
+  if(addr + len > v->end || addr + len < addr)
+    len = v->end - addr;
+  mmapsync(curproc->pgdir, v, addr, addr + len);
+  return 0;
+}
+
+// Remove the mapping that starts at addr, writing back its
+// dirty pages first.  Only whole mappings can be removed.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+
+  if((v = vmalookup(curproc, addr)) == 0 || v->type != VMA_MMAP ||
+     v->start != addr || PGROUNDUP(len) != v->end - v->start)
+    return -1;
+  mmapsync(curproc->pgdir, v, v->start, v->end);
+  deallocuvm(curproc->pgdir, v->end, v->start);
+  lcr3(V2P(curproc->pgdir));
+  begin_op();
+  iput(v->ip);
+  end_op();
+  memset(v, 0, sizeof(*v));
+  return 0;
+}
@@ -0,0 +1,70 @@
+// Compare reading a file with read() against mmap().
+//   mmapbench file [passes]
+// Sums every word of the file passes times each way and
+// prints the thousands of cycles each way took.  After the
+// first pass, the mmap() way reads the page cache in place.
+
+#include "types.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "mman.h"
+#include "user.h"
+#include "x86.h"
+
+static char buf[4096];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, passes, p, n, i, size;
+  uint sum1, sum2, *w;
+  uint64 t0, t1, t2;
+  struct stat st;
+
+  if(argc < 2){
+    printf(2, "usage: mmapbench file [passes]\n");
+    exit();
+  }
+  passes = argc > 2 ? atoi(argv[2]) : 10;
+  if((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+    printf(2, "mmapbench: cannot open %s\n", argv[1]);
+    exit();
+  }
+  size = st.size & ~3;
+  if(size == 0){
+    printf(2, "mmapbench: %s is empty\n", argv[1]);
+    exit();
+  }
+
+  t0 = rdtsc();
+  sum1 = 0;
+  for(p = 0; p < passes; p++){
+    close(fd);
+    fd = open(argv[1], O_RDONLY);
+    for(i = 0; i < size; i += n){
+      if((n = read(fd, buf, sizeof(buf))) <= 0)
+        break;
+      for(w = (uint*)buf; w < (uint*)(buf + (n & ~3)); w++)
+        sum1 += *w;
+    }
+  }
+
+  t1 = rdtsc();
+  if((w = (uint*)mmap(fd, 0, size, PROT_READ, MAP_SHARED)) == (uint*)-1){
+    printf(2, "mmapbench: mmap failed\n");
+    exit();
+  }
+  sum2 = 0;
+  for(p = 0; p < passes; p++)
+    for(i = 0; i < size / 4; i++)
+      sum2 += w[i];
+  t2 = rdtsc();
+  munmap((char*)w, size);
+  close(fd);
+
+  if(sum1 != sum2)
+    printf(1, "mmapbench: sums differ\n");
+  printf(1, "read: %d Kcycles\n", (uint)((t1 - t0) >> 10));
+  printf(1, "mmap: %d Kcycles\n", (uint)((t2 - t1) >> 10));
+  exit();
+}
@@ -0,0 +1,234 @@
+// Page cache: whole pages of file data, keyed by inode and
+// page number, that mmap()ed pages map directly.
+//
+// pcget() fills a page from the file the first time it is
+// wanted.  readi() and writei() go through a cached page
+// when there is one, so read() and write() see the same data
+// as a shared mapping.  Each entry holds one reference to its
+// page; mappings and callers of pcget() hold their own.  When
+// there are more than NPCACHE pages, ones that nobody else
+// references are evicted, and an inode's pages are dropped
+// when it is truncated or leaves the inode cache.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "memstat.h"
+#include "slab.h"
+
+#define NPCHASH 256
+#define PCHASH(ip, pgoff) ((((uint)(ip) >> 4) + (pgoff)) % NPCHASH)
+
+struct cpage {
+  struct inode *ip;
+  uint pgoff;           // Page number within the file
+  char *page;
+  struct cpage *next;   // Hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage *hash[NPCHASH];
+  uint npages;
+  uint hand;            // Next bucket to look in for eviction
+  struct slabcache cache;
+} pcache;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  slabinit(&pcache.cache, "cpagecache", sizeof(struct cpage), MEM_SLAB);
+}
+
+// Caller holds pcache.lock.
+static struct cpage*
+pclookup(struct inode *ip, uint pgoff)
+{
+  struct cpage *e;
+
+  for(e = pcache.hash[PCHASH(ip, pgoff)]; e; e = e->next)
+    if(e->ip == ip && e->pgoff == pgoff)
+      return e;
+  return 0;
+}
+
+// Unlink *pp and drop the cache's reference to its page.
+// Caller holds pcache.lock.
+static void
+pcremove(struct cpage **pp)
+{
+  struct cpage *e;
+
+  e = *pp;
+  *pp = e->next;
+  e->ip->npcache--;
+  pcache.npages--;
+  kfree(e->page);
+  slabfree(&pcache.cache, e);
+}
+
+// Evict one page that only the cache refers to, looking
+// at the buckets round-robin.  Caller holds pcache.lock.
+static void
+pcevict(void)
+{
+  struct cpage **pp;
+  int i;
+
+  for(i = 0; i < NPCHASH; i++){
+    pp = &pcache.hash[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCHASH;
+    for(; *pp; pp = &(*pp)->next){
+      if(krefcount((*pp)->page) == 1){
+        pcremove(pp);
+        return;
+      }
+    }
+  }
+}
+
+// Is page pgoff of ip in the cache?  Caller holds ip->lock,
+// so that the answer is still good for a pcget().
+int
+pccached(struct inode *ip, uint pgoff)
+{
+  int r;
+
+  acquire(&pcache.lock);
+  r = pclookup(ip, pgoff) != 0;
+  release(&pcache.lock);
+  return r;
+}
+
+// Return page pgoff of ip, reading it in if it isn't cached.
+// The caller gets a reference of its own, dropped with
+// kfree().  Bytes past the end of the file are zero.
+// Caller holds ip->lock.  Returns 0 on error.
+char*
+pcget(struct inode *ip, uint pgoff)
+{
+  struct cpage *e, **head;
+  char *mem;
+  uint off, n;
+
+  acquire(&pcache.lock);
+  if((e = pclookup(ip, pgoff)) != 0){
+    kdup(e->page);
+    release(&pcache.lock);
+    return e->page;
+  }
+  release(&pcache.lock);
+
+  off = pgoff * PGSIZE;
+  if(off >= ip->size)
+    return 0;
+  n = ip->size - off;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if((mem = kalloc(MEM_PCACHE)) == 0)
+    return 0;
+  if((e = slaballoc(&pcache.cache)) == 0){
+    kfree(mem);
+    return 0;
+  }
+  memset(mem + n, 0, PGSIZE - n);
+  if(readi(ip, mem, off, n) != n){
+    slabfree(&pcache.cache, e);
+    kfree(mem);
+    return 0;
+  }
+
+  // Only pcget() adds pages, with ip locked, so no one
+  // else can have added this one meanwhile.
+  acquire(&pcache.lock);
+  if(pcache.npages >= NPCACHE)
+    pcevict();
+  e->ip = ip;
+  e->pgoff = pgoff;
+  e->page = mem;
+  head = &pcache.hash[PCHASH(ip, pgoff)];
+  e->next = *head;
+  *head = e;
+  ip->npcache++;
+  pcache.npages++;
+  kdup(mem);
+  release(&pcache.lock);
+  return mem;
+}
+
+// Take a reference to the cached page holding byte off
+// of ip, or return 0 if it isn't cached.
+static char*
+pcpage(struct inode *ip, uint off)
+{
+  struct cpage *e;
+  char *pg;
+
+  if(ip->npcache == 0)
+    return 0;
+  pg = 0;
+  acquire(&pcache.lock);
+  if((e = pclookup(ip, off / PGSIZE)) != 0){
+    pg = e->page;
+    kdup(pg);
+  }
+  release(&pcache.lock);
+  return pg;
+}
+
+// Copy n bytes at off of ip to dst from the page cache.
+// The range must lie within one page.  Returns -1 if the
+// page isn't cached.  Called by readi().
+int
+pcread(struct inode *ip, uint off, char *dst, uint n)
+{
+  char *pg;
+
+  if((pg = pcpage(ip, off)) == 0)
+    return -1;
+  memmove(dst, pg + off % PGSIZE, n);
+  kfree(pg);
+  return 0;
+}
+
+// writei() is writing n bytes from src at off of ip; keep
+// a cached copy of the page up to date.
+void
+pcwrite(struct inode *ip, uint off, char *src, uint n)
+{
+  char *pg;
+
+  if((pg = pcpage(ip, off)) == 0)
+    return;
+  memmove(pg + off % PGSIZE, src, n);
+  kfree(pg);
+}
+
+// Drop all of ip's cached pages.  Pages still mapped stay
+// with their mappings.
+void
+pcinval(struct inode *ip)
+{
+  struct cpage **pp;
+  int i;
+
+  if(ip->npcache == 0)
+    return;
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCHASH && ip->npcache > 0; i++){
+    for(pp = &pcache.hash[i]; *pp; ){
+      if((*pp)->ip == ip)
+        pcremove(pp);
+      else
+        pp = &(*pp)->next;
+    }
+  }
+  release(&pcache.lock);
+}
@@ -2,13 +2,22 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define FSSIZE       2000  // size of file system in blocks
+#define SWAPSIZE     8192  // size of swap area after the file system, in blocks
+#define NLOCKSTAT    64  // distinct lock names tracked by lockstat
+#define SLEEPSPIN   500  // spins on a busy sleep lock before sleeping
 
+#define NVMA         16  // file-backed mappings per process
+#define NPIN          4  // user buffers one system call pins
+#define NSHM         16  // shared memory segments per system
+#define SHMPAGES    256  // maximum pages in a shared memory segment
+#define NPCACHE    1024  // page cache pages kept when nothing maps them
+#define ZPOOLPAGES  512  // most pages the compressed swap pool may use
+#define NKSM        512  // distinct pages kept for same-page merging
+#define MAXORDER     10  // largest buddy block is 2^MAXORDER pages
@@ -0,0 +1,28 @@
+// Print memory statistics for a process.
+//   pmem [pid]   default is pmem itself
+
+#include "types.h"
+#include "stat.h"
+#include "pmemstat.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct pmemstat st;
+  int pid;
+
+  pid = argc > 1 ? atoi(argv[1]) : getpid();
+  if(get_proc_mem_stats(pid, &st) < 0){
+    printf(2, "pmem: no process %d\n", pid);
+    exit();
+  }
+  printf(1, "pid %d (%s): size %d bytes\n", pid, st.name, st.sz);
+  printf(1, "%d pages resident (%d shared), %d swapped, %d reserved\n",
+         st.resident, st.shared, st.swapped, st.reserved);
+  printf(1, "%d page table pages, %d kernel stack pages\n",
+         st.ptpages, st.kstack);
+  printf(1, "%d minor faults, %d major faults, %d copy-on-write breaks\n",
+         st.nminflt, st.nmajflt, st.ncow);
+  exit();
+}
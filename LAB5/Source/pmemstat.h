@@ -0,0 +1,16 @@
+// Per-process memory statistics, filled in by
+// get_proc_mem_stats().
+struct pmemstat {
+  char name[16];
+  int state;      // enum procstate
+  uint sz;        // Size of process memory (bytes)
+  uint resident;  // Pages below sz that are mapped
+  uint shared;    // ... of which mapped elsewhere too
+  uint reserved;  // Pages below sz not touched yet
+  uint swapped;   // Pages below sz out in swap
+  uint ptpages;   // Page directory and page tables
+  uint kstack;    // Kernel stack pages
+  uint nminflt;   // Page faults served from memory
+  uint nmajflt;   // Page faults that read the disk
+  uint ncow;      // Copy-on-write pages broken
+};
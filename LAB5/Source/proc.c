@@ -7,12 +7,34 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "memstat.h"
+#include "pmemstat.h"
 
+#define NPIDHASH 64
+#define PIDHASH(pid) ((pid) & (NPIDHASH-1))
+
+// The pid hash is read without ptable.lock (see pidlookup).
+// Writers hold ptable.lock.
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct proc *pidhash[NPIDHASH];
 } ptable;
 
+// Read-copy-update style grace periods for lockless pid
+// lookups.  Readers run with interrupts off (pushcli), so
+// they can't be preempted; once every CPU has been through
+// its scheduler loop, no reader can still hold a pointer to
+// a proc that was unhashed before the grace period started.
+// Freed proc slots are not reused until then.
+// Protected by ptable.lock.
+struct {
+  uint gp;       // Last grace period started
+  uint done;     // Last grace period completed
+  uint pending;  // Bitmask of CPUs yet to pass a quiescent state
+  int queued;    // Someone needs another grace period after gp
+} rcu;
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -20,6 +42,7 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void freeproc(struct proc *p);
 
 void
 pinit(void)
@@ -33,19 +56,20 @@ cpuid() {
   return mycpu()-cpus;
 }
 
+// Find this CPU's struct cpu by its local APIC ID.
+// Only seginit() needs this, to set up %gs for mycpu().
 // Must be called with interrupts disabled to avoid the caller being
 // rescheduled between reading lapicid and running through the loop.
 struct cpu*
-mycpu(void)
+apiccpu(void)
 {
   int apicid, i;
   
   if(readeflags()&FL_IF)
-    panic("mycpu called with interrupts enabled\n");
+    panic("apiccpu called with interrupts enabled\n");
   
   apicid = lapicid();
-  // APIC IDs are not guaranteed to be contiguous. Maybe we should have
-  // a reverse map, or reserve a register to store &cpus[i].
+  // APIC IDs are not guaranteed to be contiguous.
   for (i = 0; i < ncpu; ++i) {
     if (cpus[i].apicid == apicid)
       return &cpus[i];
@@ -53,17 +77,98 @@ mycpu(void)
   panic("unknown apicid\n");
 }
 
-// Disable interrupts so that we are not rescheduled
-// while reading proc from the cpu structure
-struct proc*
-myproc(void) {
-  struct cpu *c;
+// Return the grace period that must complete before memory
+// unlinked now can be reused.  Caller must hold ptable.lock.
+static uint
+rcudefer(void)
+{
+  if(rcu.done == rcu.gp){
+    rcu.gp++;
+    rcu.pending = (1 << ncpu) - 1;
+    return rcu.gp;
+  }
+  // Readers may have started after some CPUs already
+  // reported for the current grace period; use the next.
+  rcu.queued = 1;
+  return rcu.gp + 1;
+}
+
+// Note that cpu is outside any read-side section.
+// Caller must hold ptable.lock.
+static void
+rcuquiescent(int cpu)
+{
+  if(rcu.done == rcu.gp)
+    return;
+  rcu.pending &= ~(1 << cpu);
+  if(rcu.pending == 0){
+    rcu.done = rcu.gp;
+    if(rcu.queued){
+      rcu.queued = 0;
+      rcu.gp++;
+      rcu.pending = (1 << ncpu) - 1;
+    }
+  }
+}
+
+// Find the process with the given pid without taking
+// ptable.lock.  The caller must have interrupts off
+// (pushcli) until it is done with the result; that keeps
+// the slot from being reused, though the process may
+// exit meanwhile, so check p->pid again if it matters.
+static struct proc*
+pidlookup(int pid)
+{
   struct proc *p;
-  pushcli();
-  c = mycpu();
-  p = c->proc;
-  popcli();
-  return p;
+
+  p = *(struct proc * volatile *)&ptable.pidhash[PIDHASH(pid)];
+  for(; p; p = *(struct proc * volatile *)&p->hnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Publish p in the pid hash.  Caller must hold ptable.lock.
+static void
+pidhash(struct proc *p)
+{
+  struct proc **head;
+
+  head = &ptable.pidhash[PIDHASH(p->pid)];
+  p->hnext = *head;
+  // Make p's fields visible before readers can reach it.
+  __sync_synchronize();
+  *head = p;
+}
+
+// Remove p from the pid hash.  p->hnext is left alone so
+// readers standing on p can still walk the chain.
+// Caller must hold ptable.lock.
+static void
+pidunhash(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &ptable.pidhash[PIDHASH(p->pid)]; *pp; pp = &(*pp)->hnext)
+    if(*pp == p){
+      *pp = p->hnext;
+      return;
+    }
+}
+
+// Return p to the UNUSED state.  The slot can't be handed
+// out again until readers that may have found it are gone.
+// Caller must hold ptable.lock.
+static void
+freeproc(struct proc *p)
+{
+  pidunhash(p);
+  p->rcugp = rcudefer();
+  p->pid = 0;
+  p->parent = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->state = UNUSED;
 }
 
 //PAGEBREAK: 32
@@ -80,7 +185,7 @@ allocproc(void)
   acquire(&ptable.lock);
 
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
+    if(p->state == UNUSED && (int)(p->rcugp - rcu.done) <= 0)
       goto found;
 
   release(&ptable.lock);
@@ -89,6 +194,16 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->killed = 0;
+  p->nminflt = 0;
+  p->nmajflt = 0;
+  p->ncow = 0;
+  p->pinned = 0;
+  p->npin = 0;
+  p->pinover = 0;
+  p->lender = 0;
+  p->lent = 0;
+  pidhash(p);
   p->q = 2;
   p->creation_time = ticks;
   p->waiting_time = 0;
@@ -98,8 +213,10 @@ found:
   release(&ptable.lock);
 
   // Allocate kernel stack.
-  if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+  if((p->kstack = kalloc(MEM_KSTACK)) == 0){
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -169,17 +286,39 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the space; uvmfault() allocates
+    // each page when it is first touched.
+    if(sz + n < sz || sz + n > MMAPBASE)
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
+    vmatrim(curproc->vma, sz);
   }
   curproc->sz = sz;
   switchuvm(curproc);
   return 0;
 }
 
+// Grow current process's memory by at least n bytes of
+// large pages, starting at the next LPGSIZE boundary.
+// Returns the start of the new memory, or -1.
+int
+growlarge(int n)
+{
+  uint sz, start;
+  struct proc *curproc = myproc();
+
+  sz = curproc->sz;
+  start = LPGROUNDUP(sz);
+  if(n <= 0 || (sz = allocuvmlarge(curproc->pgdir, sz, start + n)) == 0)
+    return -1;
+  curproc->sz = sz;
+  switchuvm(curproc);
+  return start;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -196,10 +335,18 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0 ||
+     vmadup(np, curproc) < 0){
+    vmarelease(0, np->vma);
+    if(np->pgdir){
+      freevm(np->pgdir);
+      np->pgdir = 0;
+    }
     kfree(np->kstack);
     np->kstack = 0;
-    np->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
   np->sz = curproc->sz;
@@ -227,6 +374,106 @@ fork(void)
   return pid;
 }
 
+// Like fork(), but the child borrows the caller's memory
+// instead of copying it, and the caller sleeps until the
+// child gives it back by calling exec() or exit().  Until
+// then the child must do nothing else; it runs on the
+// caller's stack.
+int
+vfork(void)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  np->pgdir = curproc->pgdir;
+  np->sz = curproc->sz;
+  np->lender = curproc;
+  np->parent = curproc;
+  *np->tf = *curproc->tf;
+  np->tf->eax = 0;
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  np->cwd = idup(curproc->cwd);
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+  curproc->lent = 1;
+  np->state = RUNNABLE;
+  while(curproc->lent)
+    sleep(&curproc->lent, &ptable.lock);
+  release(&ptable.lock);
+  return pid;
+}
+
+// Give the memory p borrowed with vfork() back to its
+// parent.  p must be running on a page table of its own
+// by now.  Caller holds ptable.lock.
+static void
+vforkdone1(struct proc *p)
+{
+  p->lender->lent = 0;
+  wakeup1(&p->lender->lent);
+  p->lender = 0;
+}
+
+void
+vforkdone(struct proc *p)
+{
+  acquire(&ptable.lock);
+  vforkdone1(p);
+  release(&ptable.lock);
+}
+
+// Start a child running the program path, without first
+// copying the caller's memory as fork() and exec() would.
+// If fds is not 0, it holds NOFILE entries: the child's
+// descriptor i is a dup of the caller's descriptor fds[i],
+// or closed if that is -1.  Otherwise the child gets all
+// the caller's descriptors, as with fork().
+int
+spawn(char *path, char **argv, int *fds)
+{
+  int i, pid;
+  struct file *f;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  memset(np->tf, 0, sizeof(*np->tf));
+  np->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  np->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  np->tf->es = np->tf->ds;
+  np->tf->ss = np->tf->ds;
+  np->tf->eflags = FL_IF;
+  if(execproc(np, path, argv) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
+    return -1;
+  }
+  np->parent = curproc;
+  for(i = 0; i < NOFILE; i++){
+    f = fds ? (fds[i] >= 0 ? curproc->ofile[fds[i]] : 0) : curproc->ofile[i];
+    if(f)
+      np->ofile[i] = filedup(f);
+  }
+  np->cwd = idup(curproc->cwd);
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+  np->state = RUNNABLE;
+  release(&ptable.lock);
+  return pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -240,6 +487,9 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
+  // vmarelease() sleeps writing back mapped pages.
+  curproc->pinned++;
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -248,6 +498,8 @@ exit(void)
     }
   }
 
+  vmarelease(curproc->pgdir, curproc->vma);
+  shmexit(curproc->pid);
   begin_op();
   iput(curproc->cwd);
   end_op();
@@ -255,6 +507,13 @@ exit(void)
 
   acquire(&ptable.lock);
 
+  if(curproc->lender){
+    // The memory is the parent's to free, not ours.
+    switchkvm();
+    curproc->pgdir = 0;
+    vforkdone1(curproc);
+  }
+
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
@@ -295,12 +554,11 @@ wait(void)
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        if(p->pgdir){
+          freevm(p->pgdir);
+          p->pgdir = 0;
+        }
+        freeproc(p);
         release(&ptable.lock);
         return pid;
       }
@@ -417,6 +675,7 @@ scheduler(void)
 
     acquire(&ptable.lock);
 
+    rcuquiescent(c - cpus);
     update_waiting_time();
         
     p = rr_next();
@@ -430,6 +689,10 @@ scheduler(void)
 
     if (p == 0){
       release(&ptable.lock);
+      // Nothing to run; get pages ready for kalloc_zeroed(),
+      // and look for pages to merge.
+      kzeroidle();
+      ksmidle();
       continue;
     }
 
@@ -499,6 +762,7 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -573,19 +837,142 @@ kill(int pid)
 {
   struct proc *p;
 
+  pushcli();
+  if((p = pidlookup(pid)) == 0){
+    popcli();
+    return -1;
+  }
+  p->killed = 1;
+  __sync_synchronize();
+  // Wake process from sleep if necessary.
+  if(p->state == SLEEPING){
+    acquire(&ptable.lock);
+    if(p->pid == pid && p->state == SLEEPING)
+      p->state = RUNNABLE;
+    release(&ptable.lock);
+  }
+  popcli();
+  return 0;
+}
+
+// Fill in *st for process pid.  Returns -1 if there is
+// no such process.
+int
+procmemstat(int pid, struct pmemstat *st)
+{
+  struct proc *p;
+  struct pmemstat s;
+
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
+  if((p = pidlookup(pid)) == 0 || p->pgdir == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  uvmstat(p->pgdir, p->sz, &s);
+  safestrcpy(s.name, p->name, sizeof(s.name));
+  s.state = p->state;
+  s.kstack = KSTACKSIZE / PGSIZE;
+  s.nminflt = p->nminflt;
+  s.nmajflt = p->nmajflt;
+  s.ncow = p->ncow;
+  release(&ptable.lock);
+  *st = s;
+  return 0;
+}
+
+// Copy the pids of up to n processes into pids.
+// Returns the number copied.
+int
+getpids(int *pids, int n)
+{
+  struct proc *p;
+  int i;
+
+  i = 0;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC] && i < n; p++)
+    if(p->state != UNUSED && p->state != EMBRYO)
+      pids[i++] = p->pid;
+  release(&ptable.lock);
+  return i;
+}
+
+// The clock hand of swapvictim(): a process and an
+// address in it.  Protected by ptable.lock.
+static struct proc *swaphand = ptable.proc;
+static uint swapva;
+
+// Choose a user page to swap out, replace its PTE with one
+// naming slot, and return the page.  Returns 0 if there is
+// none.  The pages of runnable and sleeping processes
+// qualify, and the caller's own: those can't be running
+// elsewhere, so they have no TLB entries to shoot down.
+// Processes that are using their page table are pinned and
+// skipped, and so are the buffers of a system call in
+// progress (see uvmpin()).  A vfork() parent is left to
+// its child.  Two sweeps are enough to find a page whose
+// PTE_A was cleared by the first.
+char*
+swapvictim(int slot)
+{
+  struct proc *p;
+  char *pg;
+  int n;
+
+  acquire(&ptable.lock);
+  for(n = 0; n < 2*NPROC; n++){
+    p = swaphand;
+    if(p->pgdir && !p->pinned && !p->lent &&
+       (p->state == RUNNABLE || p->state == SLEEPING || p == myproc())){
+      if((pg = uvmevict(p, &swapva, slot)) != 0){
+        release(&ptable.lock);
+        return pg;
+      }
     }
+    if(++swaphand == &ptable.proc[NPROC])
+      swaphand = ptable.proc;
+    swapva = 0;
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// The hand of ksmidle(), like swaphand.
+static struct proc *ksmhand = ptable.proc;
+static uint ksmva;
+
+#define KSMBATCH 16  // Pages ksmidle() looks at per tick
+
+// Called by the scheduler when this CPU has nothing to run.
+// Once per tick, offer the next few user pages of processes
+// that are not running to ksmmerge().  Those can have no
+// TLB entries, so their PTEs can change under them.  As in
+// swapvictim(), processes using their page table are left
+// alone, and so are the buffers of a system call that is
+// sleeping (see uvmmerge()).
+void
+ksmidle(void)
+{
+  static uint last;
+  struct proc *p;
+  int n, i;
+
+  if(ticks == last)
+    return;
+  acquire(&ptable.lock);
+  last = ticks;
+  n = KSMBATCH;
+  for(i = 0; n > 0 && i < NPROC; i++){
+    p = ksmhand;
+    if(p->pgdir && !p->lent && !p->pinned &&
+       (p->state == RUNNABLE || p->state == SLEEPING) &&
+       (n = uvmmerge(p, &ksmva, n)) == 0)
+      break;
+    if(++ksmhand == &ptable.proc[NPROC])
+      ksmhand = ptable.proc;
+    ksmva = 0;
   }
   release(&ptable.lock);
-  return -1;
 }
 
 //PAGEBREAK: 36
@@ -638,59 +1025,72 @@ int calculate_sum_of_digits(int n)
     return result;
 }
 
-void set_process_parent(int pid)
+int set_process_parent(int pid)
 {
   struct proc* p;
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  struct proc* myp = myproc();
+  int found = 0;
+
+  pushcli();
+  if((p = pidlookup(pid)) != 0)
   {
+    // Parent links are walked by exit() and wait() under the lock.
+    // The slot may have been reused since the lookup.
+    acquire(&ptable.lock);
     if(p->pid == pid)
     {
-      break;
+      myp->is_tracer = 1;
+      myp->tracer_parent = p->parent;
+      myp->traced_process = p;
+      p->parent = myp;
+      found = 1;
     }
+    release(&ptable.lock);
   }
-  struct proc* myp = myproc();
-  myp->is_tracer = 1;
-  myp->tracer_parent = p->parent;
-  myp->traced_process = p;
-  p->parent = myproc();
-  cprintf("process %d parent changed to %d\n", p->pid, myp->pid);
+  popcli();
+  if(!found)
+  {
+    cprintf("process %d not found\n", pid);
+    return -1;
+  }
+  cprintf("process %d parent changed to %d\n", pid, myp->pid);
+  return 0;
 }
 
+// The scheduler reads q and hrrn_priority under ptable.lock,
+// but single-word stores can't be torn, so these setters
+// only need the lockless lookup and never stall scheduling.
 void change_process_queue(int pid, int dest_q)
 {
   struct proc *p;
 
-  acquire(&ptable.lock);
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  pushcli();
+  if((p = pidlookup(pid)) == 0)
   {
-    if (p->pid == pid)
-    {
-      break;
-    }
+    popcli();
+    cprintf("process %d not found\n", pid);
+    return;
   }
   p->q = dest_q;
   p->waiting_time = 0;
-  cprintf("process %d priority changed to %d\n", p->pid, dest_q);
-
-  release(&ptable.lock);
+  popcli();
+  cprintf("process %d priority changed to %d\n", pid, dest_q);
 }
 
 void set_hrrn_priority(int pid, int new_priority)
 {
   struct proc *p;
 
-  acquire(&ptable.lock);
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  pushcli();
+  if((p = pidlookup(pid)) == 0)
   {
-    if (p->pid == pid)
-    {
-      break;
-    }
+    popcli();
+    cprintf("process %d not found\n", pid);
+    return;
   }
   p->hrrn_priority = new_priority;
-  cprintf("process %d HRRN priority changed to %d\n", p->pid, new_priority);
-
-  release(&ptable.lock);
+  popcli();
+  cprintf("process %d HRRN priority changed to %d\n", pid, new_priority);
 }
 
 void set_ptable_hrrn_priority(int new_priority)
@@ -1,5 +1,9 @@
 // Per-CPU state
+// Aligned to a cache line so that CPUs updating their own
+// ncli or proc don't bounce each other's lines.
 struct cpu {
+  struct cpu *self;            // This struct, at %gs:0 (see seginit)
+  struct proc *proc;           // The process running on this cpu or null, at %gs:4
   uchar apicid;                // Local APIC ID
   struct context *scheduler;   // swtch() here to enter scheduler
   struct taskstate ts;         // Used by x86 to find stack for interrupt
@@ -7,12 +11,35 @@ struct cpu {
   volatile uint started;       // Has the CPU started?
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
-  struct proc *proc;           // The process running on this cpu or null
-};
+} __attribute__((aligned(CACHELINE)));
 
 extern struct cpu cpus[NCPU];
 extern int ncpu;
 
+// seginit() points %gs at this CPU's struct cpu, so the
+// current cpu and proc are each a single load.  The kernel
+// reloads %gs on every trap (see trapasm.S).
+static inline struct cpu*
+mycpu(void)
+{
+  struct cpu *c;
+
+  asm volatile("movl %%gs:0, %0" : "=r" (c));
+  return c;
+}
+
+// A single load can't be split by an interrupt, and if the
+// process migrates it is still the current proc on the new
+// CPU, so this needs no pushcli.
+static inline struct proc*
+myproc(void)
+{
+  struct proc *p;
+
+  asm volatile("movl %%gs:4, %0" : "=r" (p));
+  return p;
+}
+
 //PAGEBREAK: 17
 // Saved registers for kernel context switches.
 // Don't need to save all the segment registers (%cs, etc),
@@ -32,6 +59,33 @@ struct context {
   uint eip;
 };
 
+// A range of user memory that is not plain anonymous memory:
+// program text and data that uvmfault() reads in from a file
+// when first touched, a shared memory segment, or a file
+// mapped with mmap().
+struct vma {
+  int type;           // VMA_ below, or 0 if the slot is free
+  uint start;         // First address, page aligned
+  uint end;           // Address after the last page
+  struct inode *ip;   // VMA_FILE, VMA_MMAP: backing file
+  uint off;           // VMA_FILE, VMA_MMAP: file offset of start
+  uint filesz;        // VMA_FILE: bytes from the file; the rest is zeros
+  int shmid;          // VMA_SHM: segment
+  int prot;           // VMA_MMAP: PROT_ bits
+  int flags;          // VMA_MMAP: MAP_SHARED or MAP_PRIVATE
+};
+
+#define VMA_FILE 1  // Paged in from ip, below sz
+#define VMA_SHM  2  // Shared memory segment, above MMAPBASE
+#define VMA_MMAP 3  // mmap()ed file, above MMAPBASE
+
+// User memory the current system call holds a pointer into,
+// from argptr() or argstr().  See uvmpin().
+struct pinrange {
+  uint start;         // Page aligned
+  uint end;
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -58,6 +112,18 @@ struct proc {
   long waiting_time;
   long executed_cycle_number;
   int hrrn_priority;
+  struct proc *hnext;          // Next proc in pid hash chain
+  uint rcugp;                  // Grace period to wait for before reuse
+  uint nminflt;                // Page faults served from memory
+  uint nmajflt;                // Page faults that read the disk
+  uint ncow;                   // Copy-on-write pages broken
+  int pinned;                  // Using its page table: don't swap out or merge
+  struct pinrange pin[NPIN];   // ... or at least not these pages
+  int npin;
+  int pinover;                 // Ran out of pin[], so pinned all instead
+  struct proc *lender;         // vfork() parent whose memory this borrows
+  int lent;                    // Memory is lent to a vfork() child
+  struct vma vma[NVMA];        // File-backed parts of memory
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,84 @@
+// List processes with the physical memory each one holds,
+// largest first.
+//   ps
+// RSS is resident user pages, PT page directory and page
+// table pages, TOTAL adds the kernel stack.  Sizes are in
+// pages.
+
+#include "types.h"
+#include "stat.h"
+#include "param.h"
+#include "pmemstat.h"
+#include "user.h"
+
+static char *statename[] = { "unused", "embryo", "sleep", "ready", "run", "zombie" };
+
+struct row {
+  int pid;
+  uint total;
+  struct pmemstat st;
+};
+
+// Print n right-aligned in a column w wide.
+static void
+col(int w, uint n)
+{
+  uint m;
+
+  for(m = n / 10; m > 0; m /= 10)
+    w--;
+  while(--w > 0)
+    printf(1, " ");
+  printf(1, "%d", n);
+}
+
+static void
+scol(int w, char *s)
+{
+  printf(1, " %s", s);
+  for(w -= strlen(s); w > 0; w--)
+    printf(1, " ");
+}
+
+int
+main(void)
+{
+  static struct row rows[NPROC];
+  struct row r;
+  int pids[NPROC];
+  int i, j, n, np;
+
+  np = getpids(pids, NPROC);
+  n = 0;
+  for(i = 0; i < np; i++){
+    // The process may have gone away meanwhile.
+    if(get_proc_mem_stats(pids[i], &rows[n].st) < 0)
+      continue;
+    rows[n].pid = pids[i];
+    rows[n].total = rows[n].st.resident + rows[n].st.ptpages + rows[n].st.kstack;
+    n++;
+  }
+  for(i = 1; i < n; i++){
+    r = rows[i];
+    for(j = i; j > 0 && rows[j-1].total < r.total; j--)
+      rows[j] = rows[j-1];
+    rows[j] = r;
+  }
+
+  printf(1, "  PID NAME       STATE    TOTAL   RSS   SHR  SWAP    PT  MINFLT  MAJFLT     COW\n");
+  for(i = 0; i < n; i++){
+    col(5, rows[i].pid);
+    scol(10, rows[i].st.name);
+    scol(6, statename[rows[i].st.state]);
+    col(8, rows[i].total);
+    col(6, rows[i].st.resident);
+    col(6, rows[i].st.shared);
+    col(6, rows[i].st.swapped);
+    col(6, rows[i].st.ptpages);
+    col(8, rows[i].st.nminflt);
+    col(8, rows[i].st.nmajflt);
+    col(8, rows[i].st.ncow);
+    printf(1, "\n");
+  }
+  exit();
+}
@@ -3,6 +3,7 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "param.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +53,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +132,83 @@ runcmd(struct cmd *cmd)
   exit();
 }
 
+// Can cmd run without a forked copy of the shell?
+// Lists and background jobs need one to wait in.
+int
+canspawn(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case EXEC:
+    return 1;
+  case REDIR:
+    return canspawn(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    return canspawn(((struct pipecmd*)cmd)->left) &&
+           canspawn(((struct pipecmd*)cmd)->right);
+  }
+  return 0;
+}
+
+// Start cmd with spawn(), which builds each child straight
+// from its program instead of from a copy of the shell.
+// fds[i] is the shell's descriptor that the children get
+// as descriptor i.  Returns the number of children started.
+int
+spawncmd(struct cmd *cmd, int *fds)
+{
+  int p[2], fd, old, n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  default:
+    panic("spawncmd");
+
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, fds) < 0){
+      printf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      printf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    old = fds[rcmd->fd];
+    fds[rcmd->fd] = fd;
+    n = spawncmd(rcmd->cmd, fds);
+    fds[rcmd->fd] = old;
+    close(fd);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      printf(2, "pipe failed\n");
+      return 0;
+    }
+    old = fds[1];
+    fds[1] = p[1];
+    n = spawncmd(pcmd->left, fds);
+    fds[1] = old;
+    old = fds[0];
+    fds[0] = p[0];
+    n += spawncmd(pcmd->right, fds);
+    fds[0] = old;
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  return 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,7 +224,8 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, n, fds[NOFILE];
+  struct cmd *cmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,9 +244,19 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(canspawn(cmd)){
+      for(fd = 0; fd < NOFILE; fd++)
+        fds[fd] = fd < 3 ? fd : -1;
+      for(n = spawncmd(cmd, fds); n > 0; n--)
+        wait();
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait();
+    }
+    freecmd(cmd);
   }
   exit();
 }
@@ -324,18 +414,37 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// The first syntax error in the command being parsed.
+// The shell parses in the parent, so errors can't exit.
+char *parseerr;
+
+void
+syntaxerr(char *s)
+{
+  if(parseerr == 0)
+    parseerr = s;
+}
+
+// Returns 0 after printing a message if s is not a
+// valid command.
 struct cmd*
 parsecmd(char *s)
 {
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && parseerr == 0){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntaxerr("syntax");
+  }
+  if(parseerr){
+    printf(2, "%s\n", parseerr);
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +488,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntaxerr("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +516,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntaxerr("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +544,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntaxerr("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntaxerr("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +608,29 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free the nodes of a parsed command.  The strings
+// point into the input buffer.
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
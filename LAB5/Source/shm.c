@@ -0,0 +1,210 @@
+// Shared memory segments.
+//
+// shmget() finds or creates a segment by key.  shmat() maps
+// all of its pages into the calling process above MMAPBASE,
+// and shmdt() unmaps them again.  Each mapping holds a page
+// reference of its own, so the pages stay valid for as long
+// as anyone maps them; the segment keeps one more reference
+// per page, dropped when the last process detaches, or when
+// its creator exits if no one has it attached then.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "memstat.h"
+
+struct shmseg {
+  int key;
+  int used;              // Slot holds a segment
+  int ready;             // ... whose pages are all allocated
+  int creator;           // Pid of the process that made it
+  int nattach;           // Mappings of the segment, in all processes
+  int npages;
+  char *pages[SHMPAGES];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shm;
+
+void
+shminit(void)
+{
+  initlock(&shm.lock, "shm");
+}
+
+// Free the pages of segment s.  Caller holds shm.lock.
+static void
+shmfree(struct shmseg *s)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++)
+    kfree(s->pages[i]);
+  s->used = 0;
+  s->ready = 0;
+  s->npages = 0;
+}
+
+// Return the id of the segment with key, creating it with
+// size bytes of zeroed memory if there is none.
+// Returns -1 if an existing segment is smaller than size
+// or there is no room for a new one.
+int
+shmget(int key, int size)
+{
+  struct shmseg *s, *free;
+  int i, n;
+
+  if(size <= 0 || size > SHMPAGES*PGSIZE)
+    return -1;
+  acquire(&shm.lock);
+again:
+  free = 0;
+  for(s = shm.seg; s < &shm.seg[NSHM]; s++){
+    if(s->used && s->key == key){
+      if(!s->ready){
+        // Another shmget() is still allocating it.
+        sleep(s, &shm.lock);
+        goto again;
+      }
+      i = s->npages * PGSIZE < size ? -1 : s - shm.seg;
+      release(&shm.lock);
+      return i;
+    }
+    if(!s->used && free == 0)
+      free = s;
+  }
+  if((s = free) == 0){
+    release(&shm.lock);
+    return -1;
+  }
+
+  // Claim the slot, then allocate and zero the pages without
+  // holding the lock.  No one uses the segment until ready.
+  s->key = key;
+  s->used = 1;
+  s->ready = 0;
+  s->creator = myproc()->pid;
+  s->nattach = 0;
+  s->npages = 0;
+  release(&shm.lock);
+  n = PGROUNDUP(size) / PGSIZE;
+  for(i = 0; i < n; i++)
+    if((s->pages[i] = kalloc_zeroed(MEM_USER)) == 0)
+      break;
+
+  acquire(&shm.lock);
+  s->npages = i;
+  if(i < n)
+    shmfree(s);
+  else
+    s->ready = 1;
+  wakeup(s);
+  release(&shm.lock);
+  return i < n ? -1 : s - shm.seg;
+}
+
+// Map segment id into the current process.
+// Returns the address it is mapped at, or -1.
+int
+shmat(int id)
+{
+  struct proc *curproc = myproc();
+  struct shmseg *s;
+  struct vma *v;
+  uint va;
+  int i;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++)
+    if(v->type == 0)
+      break;
+  if(v == &curproc->vma[NVMA])
+    return -1;
+
+  acquire(&shm.lock);
+  s = &shm.seg[id];
+  if(!s->ready || (va = vmaspace(curproc, s->npages * PGSIZE)) == 0){
+    release(&shm.lock);
+    return -1;
+  }
+  for(i = 0; i < s->npages; i++){
+    if(mappages(curproc->pgdir, (char*)va + i*PGSIZE, PGSIZE,
+                V2P(s->pages[i]), PTE_W|PTE_U) < 0){
+      release(&shm.lock);
+      deallocuvm(curproc->pgdir, va + i*PGSIZE, va);
+      return -1;
+    }
+    kdup(s->pages[i]);
+  }
+  s->nattach++;
+  release(&shm.lock);
+
+  v->type = VMA_SHM;
+  v->start = va;
+  v->end = va + s->npages * PGSIZE;
+  v->shmid = id;
+  return va;
+}
+
+// Unmap the segment attached at addr in the current process.
+int
+shmdt(uint addr)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+
+  if((v = vmalookup(curproc, addr)) == 0 || v->type != VMA_SHM ||
+     v->start != addr)
+    return -1;
+  deallocuvm(curproc->pgdir, v->end, v->start);
+  lcr3(V2P(curproc->pgdir));
+  shmput(v->shmid);
+  memset(v, 0, sizeof(*v));
+  return 0;
+}
+
+// Another mapping of segment id, made by fork().
+void
+shmdup(int id)
+{
+  acquire(&shm.lock);
+  shm.seg[id].nattach++;
+  release(&shm.lock);
+}
+
+// A mapping of segment id went away.  Free the segment
+// with the last one.
+void
+shmput(int id)
+{
+  struct shmseg *s;
+
+  acquire(&shm.lock);
+  s = &shm.seg[id];
+  if(--s->nattach == 0)
+    shmfree(s);
+  release(&shm.lock);
+}
+
+// Process pid is exiting, with its own mappings gone.  Free
+// the segments it made that no one has attached.
+void
+shmexit(int pid)
+{
+  struct shmseg *s;
+
+  acquire(&shm.lock);
+  for(s = shm.seg; s < &shm.seg[NSHM]; s++)
+    if(s->ready && s->creator == pid && s->nattach == 0)
+      shmfree(s);
+  release(&shm.lock);
+}
@@ -0,0 +1,60 @@
+// Shared memory producer/consumer.
+// The parent fills a shared buffer of kb kilobytes and the
+// child sums it, rounds times over.  Only a one-byte token
+// per round goes through the kernel; the data never does.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define KEY 0x5043
+
+int
+main(int argc, char *argv[])
+{
+  int kb, rounds, size, id, r, i, toc[2], top[2];
+  uint *buf, sum, want;
+  char t;
+
+  kb = argc > 1 ? atoi(argv[1]) : 64;
+  rounds = argc > 2 ? atoi(argv[2]) : 100;
+  size = kb * 1024;
+  if((id = shmget(KEY, size)) < 0 || (buf = (uint*)shmat(id)) == (uint*)-1){
+    printf(2, "shmpc: no shared memory\n");
+    exit();
+  }
+  if(pipe(toc) < 0 || pipe(top) < 0){
+    printf(2, "shmpc: pipe failed\n");
+    exit();
+  }
+
+  if(fork() == 0){
+    // Consumer: the segment is inherited across fork.
+    for(r = 0; r < rounds; r++){
+      if(read(toc[0], &t, 1) != 1)
+        break;
+      sum = 0;
+      for(i = 0; i < size / 4; i++)
+        sum += buf[i];
+      want = (uint)r * (size / 4);
+      if(sum != want)
+        printf(1, "shmpc: round %d: sum %d, want %d\n", r, sum, want);
+      write(top[1], &t, 1);
+    }
+    shmdt((char*)buf);
+    exit();
+  }
+
+  // Producer.
+  for(r = 0; r < rounds; r++){
+    for(i = 0; i < size / 4; i++)
+      buf[i] = r;
+    write(toc[1], &t, 1);
+    if(read(top[0], &t, 1) != 1)
+      break;
+  }
+  wait();
+  shmdt((char*)buf);
+  printf(1, "shmpc: %d rounds of %d KB\n", rounds, kb);
+  exit();
+}
@@ -0,0 +1,173 @@
+// Slab allocator for small kernel objects.
+//
+// A slab is one page: a struct slab header followed by
+// perslab objects of the cache's size.  Free objects in a
+// slab are chained through their first word, and any object
+// finds its slab by rounding its address down to the page.
+// Slabs with free objects sit on the cache's partial list;
+// a slab whose last object is freed goes back to kalloc(),
+// so a cache only holds as many pages as it has objects.
+//
+// In front of the slabs each CPU keeps a small stack of
+// free objects, so most slaballoc() and slabfree() calls
+// touch only per-CPU data with interrupts disabled.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct slabcache *cache;
+  struct slab *next;    // On cache->partial
+  struct slab *prev;
+  void *free;           // Free objects in this slab
+  uint inuse;
+};
+
+#define OBJALIGN  8
+#define SLABHDR   ((sizeof(struct slab) + OBJALIGN-1) & ~(OBJALIGN-1))
+
+void
+slabinit(struct slabcache *c, char *name, uint size, int type)
+{
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->size = (size + OBJALIGN-1) & ~(OBJALIGN-1);
+  if(c->size < sizeof(void*))
+    c->size = sizeof(void*);
+  c->perslab = (PGSIZE - SLABHDR) / c->size;
+  if(c->perslab == 0)
+    panic("slabinit: object too large");
+  c->type = type;
+  initlock(&c->lock, name);
+}
+
+static void
+partialadd(struct slabcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+static void
+partialremove(struct slabcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Get a fresh slab page and chain all its objects.
+// Caller holds c->lock.
+static struct slab*
+slabgrow(struct slabcache *c)
+{
+  struct slab *s;
+  char *obj;
+  uint i;
+
+  if((s = (struct slab*)kalloc(c->type)) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  obj = (char*)s + SLABHDR + (c->perslab - 1) * c->size;
+  for(i = 0; i < c->perslab; i++, obj -= c->size){
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  c->nslabs++;
+  partialadd(c, s);
+  return s;
+}
+
+// Move up to SLABCPUBATCH objects from the slabs to sc.
+// Caller holds c->lock.
+static void
+slabrefill(struct slabcache *c, struct slabcpu *sc)
+{
+  struct slab *s;
+  void *obj;
+
+  while(sc->n < SLABCPUBATCH){
+    if((s = c->partial) == 0 && (s = slabgrow(c)) == 0)
+      break;
+    obj = s->free;
+    s->free = *(void**)obj;
+    if(++s->inuse == c->perslab)
+      partialremove(c, s);
+    c->nused++;
+    sc->obj[sc->n++] = obj;
+  }
+}
+
+// Return obj to its slab, and the slab to kalloc()
+// if that leaves it empty.  Caller holds c->lock.
+static void
+slabput(struct slabcache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->cache != c)
+    panic("slabfree: wrong cache");
+  if(s->inuse-- == c->perslab)
+    partialadd(c, s);
+  *(void**)obj = s->free;
+  s->free = obj;
+  c->nused--;
+  if(s->inuse == 0){
+    partialremove(c, s);
+    c->nslabs--;
+    kfree((char*)s);
+  }
+}
+
+// Allocate an object from c.  Its contents are undefined.
+// Returns 0 if memory cannot be allocated.
+void*
+slaballoc(struct slabcache *c)
+{
+  struct slabcpu *sc;
+  void *obj;
+
+  pushcli();
+  sc = &c->cpu[cpuid()];
+  if(sc->n == 0){
+    acquire(&c->lock);
+    slabrefill(c, sc);
+    release(&c->lock);
+  }
+  obj = sc->n > 0 ? sc->obj[--sc->n] : 0;
+  popcli();
+  return obj;
+}
+
+// Free an object allocated from c.
+void
+slabfree(struct slabcache *c, void *obj)
+{
+  struct slabcpu *sc;
+  int i;
+
+  pushcli();
+  sc = &c->cpu[cpuid()];
+  if(sc->n == SLABCPUMAX){
+    acquire(&c->lock);
+    for(i = 0; i < SLABCPUBATCH; i++)
+      slabput(c, sc->obj[--sc->n]);
+    release(&c->lock);
+  }
+  sc->obj[sc->n++] = obj;
+  popcli();
+}
@@ -0,0 +1,25 @@
+// Object caches for small fixed-size kernel objects.
+// Each cache carves whole pages from kalloc() into equal
+// objects; see slab.c.  Needs param.h, mmu.h and spinlock.h.
+
+#define SLABCPUMAX   16  // objects a CPU may hold per cache
+#define SLABCPUBATCH  8  // objects moved per refill or drain
+
+struct slab;
+
+struct slabcpu {
+  void *obj[SLABCPUMAX];  // Free objects owned by this CPU
+  int n;
+} __attribute__((aligned(CACHELINE)));
+
+struct slabcache {
+  char *name;
+  uint size;            // Object size, rounded up
+  uint perslab;         // Objects per slab page
+  int type;             // MEM_ type charged for slab pages
+  struct spinlock lock; // Protects the fields below
+  struct slab *partial; // Slabs with at least one free object
+  uint nslabs;          // Pages owned by this cache
+  uint nused;           // Objects handed out of the slabs
+  struct slabcpu cpu[NCPU];
+};
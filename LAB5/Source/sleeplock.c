@@ -17,17 +17,51 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->nwait = 0;
 }
 
+// Is the holder of lk running on another CPU?  If so it is
+// likely to release the lock soon.
+static int
+ownerrunning(struct sleeplock *lk)
+{
+  struct proc *owner;
+
+  owner = *(struct proc * volatile *)&lk->owner;
+  return *(volatile uint*)&lk->locked && owner != 0 &&
+         owner->state == RUNNING;
+}
+
+// Adaptive acquire: while the holder is running on another
+// CPU, spin for up to SLEEPSPIN iterations (with lk->lk
+// released and interrupts on), since most inode and buffer
+// critical sections are shorter than a context switch.
+// Sleep only once the holder is off-CPU or the budget is used.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  int spins;
+
+  spins = 0;
   acquire(&lk->lk);
   while (lk->locked) {
+    if(spins < SLEEPSPIN && ownerrunning(lk)){
+      release(&lk->lk);
+      while(spins < SLEEPSPIN && ownerrunning(lk)){
+        pause();
+        spins++;
+      }
+      acquire(&lk->lk);
+      continue;
+    }
+    lk->nwait++;
     sleep(lk, &lk->lk);
+    lk->nwait--;
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
   release(&lk->lk);
 }
 
@@ -37,7 +71,11 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  lk->owner = 0;
+  // Spinning waiters will see locked == 0; only
+  // take ptable.lock if someone is actually asleep.
+  if(lk->nwait > 0)
+    wakeup(lk);
   release(&lk->lk);
 }
 
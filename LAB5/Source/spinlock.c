@@ -9,28 +9,92 @@
 #include "proc.h"
 #include "spinlock.h"
 
+#ifdef LOCKSTAT
+// Statistics are merged by lock name, so every pipe lock (or
+// every sleep lock) shows up as a single entry.  Counters are
+// updated while holding the lock they describe, so updates
+// from different locks that share a name may race; the merged
+// numbers are approximate, which is fine for finding hot spots.
+static struct lockstat lockstats[NLOCKSTAT];
+static uint nlockstats;
+static uint lockstatlock;  // Protects nlockstats; can't be a spinlock.
+
+static struct lockstat*
+lockstatlookup(char *name)
+{
+  struct lockstat *s;
+
+  while(xchg(&lockstatlock, 1) != 0)
+    pause();
+  for(s = lockstats; s < &lockstats[nlockstats]; s++)
+    if(s->name == name || strncmp(s->name, name, 16) == 0)
+      goto found;
+  if(nlockstats == NLOCKSTAT){
+    s = 0;
+    goto found;
+  }
+  s = &lockstats[nlockstats];
+  s->name = name;
+  __sync_synchronize();
+  nlockstats++;
+found:
+  xchg(&lockstatlock, 0);
+  return s;
+}
+#endif
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+#ifdef LOCKSTAT
+  lk->stat = lockstatlookup(name);
+#endif
 }
 
 // Acquire the lock.
-// Loops (spins) until the lock is acquired.
+// Takes a ticket and loops (spins) until it is served.
 // Holding a lock for a long time may cause
 // other CPUs to waste time spinning to acquire it.
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket;
+#ifdef LOCKSTAT
+  uint64 start;
+  int contended;
+#endif
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+#ifdef LOCKSTAT
+  start = rdtsc();
+#endif
+  // The xadd is atomic. Waiters then only read owner,
+  // so the cache line is not bounced between spinners.
+  ticket = fetchadd(&lk->next, 1);
+#ifdef LOCKSTAT
+  contended = *(volatile uint*)&lk->owner != ticket;
+#endif
+  while(*(volatile uint*)&lk->owner != ticket)
+    pause();
+  lk->locked = 1;
+#ifdef LOCKSTAT
+  if(lk->stat){
+    lk->acquired = rdtsc();
+    lk->stat->nacquire++;
+    if(contended){
+      lk->stat->ncontend++;
+      lk->stat->spin += lk->acquired - start;
+    }
+  }
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -46,11 +110,24 @@ acquire(struct spinlock *lk)
 void
 release(struct spinlock *lk)
 {
+#ifdef LOCKSTAT
+  uint64 hold;
+#endif
+
   if(!holding(lk))
     panic("release");
 
+#ifdef LOCKSTAT
+  if(lk->stat){
+    hold = rdtsc() - lk->acquired;
+    if(hold > lk->stat->maxhold)
+      lk->stat->maxhold = hold;
+  }
+#endif
+
   lk->pcs[0] = 0;
   lk->cpu = 0;
+  lk->locked = 0;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that all the stores in the critical
@@ -59,10 +136,10 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  // Release the lock by serving the next ticket. Only the
+  // holder writes owner, so a plain increment is enough, but
+  // it must be a single store the compiler cannot split.
+  asm volatile("incl %0" : "+m" (lk->owner) : );
 
   popcli();
 }
@@ -124,3 +201,73 @@ popcli(void)
     sti();
 }
 
+// Lock microbenchmark: hammer a single shared lock until
+// nticks clock ticks have passed and return the number of
+// acquisitions this caller got.  Running one caller per CPU
+// shows both throughput and how evenly the lock is shared.
+static struct spinlock benchlock = { .name = "bench" };
+static uint benchcount;
+
+int
+lockbench(int nticks)
+{
+  uint start, n;
+
+  n = 0;
+  start = *(volatile uint*)&ticks;
+  while(*(volatile uint*)&ticks - start < nticks){
+    acquire(&benchlock);
+    benchcount++;
+    release(&benchlock);
+    n++;
+  }
+  return n;
+}
+
+// Print the n locks with the most cycles spent waiting
+// for them, or zero all counters if reset is set.
+// Cycle counts are printed in units of 1024 cycles.
+int
+lockstat(int n, int reset)
+{
+#ifdef LOCKSTAT
+  struct lockstat *s;
+  uchar order[NLOCKSTAT], t;
+  int i, j, cnt;
+
+  cnt = nlockstats;
+  if(reset){
+    for(s = lockstats; s < &lockstats[cnt]; s++){
+      s->nacquire = 0;
+      s->ncontend = 0;
+      s->spin = 0;
+      s->maxhold = 0;
+    }
+    return 0;
+  }
+
+  for(i = 0; i < cnt; i++)
+    order[i] = i;
+  if(n < 0)
+    n = 0;
+  if(n > cnt)
+    n = cnt;
+  for(i = 0; i < n; i++)
+    for(j = i + 1; j < cnt; j++)
+      if(lockstats[order[j]].spin > lockstats[order[i]].spin){
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+      }
+
+  for(i = 0; i < n; i++){
+    s = &lockstats[order[i]];
+    cprintf("%s: acquire %d contend %d spin %dKc maxhold %dKc\n",
+            s->name, s->nacquire, s->ncontend,
+            (uint)(s->spin >> 10), (uint)(s->maxhold >> 10));
+  }
+  return n;
+#else
+  return -1;
+#endif
+}
@@ -1,11 +1,31 @@
 // Mutual exclusion lock.
+// A ticket lock: acquirers take the next ticket and spin
+// until owner reaches it, so the lock is granted in FIFO
+// order and waiters only read the shared cache line.
 struct spinlock {
   uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out
+  uint owner;        // Ticket currently allowed to hold the lock
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+#ifdef LOCKSTAT
+  struct lockstat *stat; // Statistics shared by locks with this name
+  uint64 acquired;       // rdtsc() when the lock was last acquired
+#endif
 };
 
+#ifdef LOCKSTAT
+// Contention statistics, kept per lock name.
+struct lockstat {
+  char *name;
+  uint nacquire;     // Number of acquisitions
+  uint ncontend;     // Acquisitions that had to wait
+  uint64 spin;       // Total cycles spent waiting
+  uint64 maxhold;    // Longest time the lock was held, in cycles
+};
+#endif
+
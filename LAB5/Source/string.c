@@ -33,6 +33,7 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  uint m;
 
   s = src;
   d = dst;
@@ -41,9 +42,19 @@ memmove(void *dst, const void *src, uint n)
     d += n;
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else if(n < 16){
     while(n-- > 0)
       *d++ = *s++;
+  } else {
+    // Copy a word at a time, once d is aligned.  Going
+    // forwards is safe even if the ranges overlap, since
+    // d is below s then.
+    m = -(uint)d & 3;
+    movsb(d, s, m);
+    movsl(d + m, s + m, (n - m) / 4);
+    m += (n - m) & ~3;
+    movsb(d + m, s + m, n - m);
+  }
 
   return dst;
 }
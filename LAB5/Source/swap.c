@@ -0,0 +1,209 @@
+// Swapping user pages out to disk under memory pressure.
+//
+// The swap area is the sb.nswap blocks after the file system,
+// cut into slots of one page each.  A swapped-out page leaves
+// behind a PTE with PTE_P clear, PTE_SWAP set and the slot
+// number where the page address was; uvmfault() reads the
+// page back in when it is touched.  fork() copies such PTEs
+// as they are, so slots are reference counted.
+//
+// swapout() picks its victims with the clock algorithm: a
+// hand sweeps over the user pages of all processes, and a
+// page whose PTE_A is set has it cleared and gets a second
+// chance (see swapvictim() and uvmevict()).
+//
+// A page that compresses well is kept in the zswap.c pool
+// under its slot instead of being written out.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "memstat.h"
+
+#define SLOTBLKS (PGSIZE / BSIZE)  // Blocks per slot
+#define NSLOT (SWAPSIZE / SLOTBLKS)
+
+struct {
+  struct spinlock lock;
+  uint start;          // First block of the swap area
+  int nslot;           // Usable slots; 0 before swapinit()
+  int nused;
+  uchar ref[NSLOT];    // PTEs naming each slot
+  uchar busy[NSLOT];   // Slot is still being written
+  uint nout;           // Pages swapped out so far
+  uint nin;            // Pages swapped in so far
+  uint nzin;           // ... of which from the compressed pool
+  uint64 zcycles;      // Time spent on swapin()s from the pool
+  uint64 diskcycles;   // ... and from disk
+} swap;
+
+// Called from forkret(), since reading the superblock sleeps.
+void
+swapinit(int dev)
+{
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  readsb(dev, &sb);
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / SLOTBLKS;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+}
+
+// Find a free slot and mark it busy with one reference.
+static int
+slotalloc(void)
+{
+  int i;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    if(swap.ref[i] == 0 && !swap.busy[i]){
+      swap.ref[i] = 1;
+      swap.busy[i] = 1;
+      swap.nused++;
+      release(&swap.lock);
+      return i;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Caller holds swap.lock.
+static void
+slotfree(int slot)
+{
+  swap.nused--;
+  zfree(slot);
+}
+
+// Caller holds swap.lock.
+static void
+slotput(int slot)
+{
+  if(swap.ref[slot] == 0)
+    panic("slotput");
+  if(--swap.ref[slot] == 0 && !swap.busy[slot])
+    slotfree(slot);
+}
+
+// Another PTE names slot, as fork() copies them.
+void
+swapdup(int slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0 || swap.ref[slot] == 0xff)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// A PTE naming slot has gone away.
+void
+swapput(int slot)
+{
+  acquire(&swap.lock);
+  slotput(slot);
+  release(&swap.lock);
+}
+
+// Write one user page out to swap, so that its memory can
+// be freed.  May sleep, so the caller must not hold any
+// spinlocks, nor pointers into the page tables of processes
+// whose pages could be chosen (see swapvictim()).
+// Returns 0 if a page was freed, -1 if none could be.
+int
+swapout(void)
+{
+  struct buf *b;
+  char *pg;
+  int slot, i;
+
+  if((slot = slotalloc()) < 0)
+    return -1;
+  if((pg = swapvictim(slot)) == 0){
+    acquire(&swap.lock);
+    swap.busy[slot] = 0;
+    slotput(slot);
+    release(&swap.lock);
+    return -1;
+  }
+  if(zstore(slot, pg) < 0){
+    for(i = 0; i < SLOTBLKS; i++){
+      b = bgetnew(ROOTDEV, swap.start + slot*SLOTBLKS + i);
+      memmove(b->data, pg + i*BSIZE, BSIZE);
+      bwrite(b);
+      brelse(b);
+    }
+  }
+  acquire(&swap.lock);
+  swap.busy[slot] = 0;
+  swap.nout++;
+  // The owner may have exited while the page was written.
+  if(swap.ref[slot] == 0)
+    slotfree(slot);
+  wakeup(&swap.busy[slot]);
+  release(&swap.lock);
+  kfree(pg);
+  return 0;
+}
+
+// Read slot back into the page mem, and drop the
+// reference of the PTE that named it.  Sleeps.  Returns
+// 1 if the page had to come from disk, 0 if from the pool.
+int
+swapin(int slot, char *mem)
+{
+  struct buf *b;
+  uint64 t;
+  int i, z;
+
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  release(&swap.lock);
+  t = rdtsc();
+  if((z = zload(slot, mem)) < 0){
+    for(i = 0; i < SLOTBLKS; i++){
+      b = bread(ROOTDEV, swap.start + slot*SLOTBLKS + i);
+      memmove(mem + i*BSIZE, b->data, BSIZE);
+      brelse(b);
+    }
+  }
+  t = rdtsc() - t;
+  acquire(&swap.lock);
+  swap.nin++;
+  if(z == 0){
+    swap.nzin++;
+    swap.zcycles += t;
+  } else {
+    swap.diskcycles += t;
+  }
+  slotput(slot);
+  release(&swap.lock);
+  return z < 0;
+}
+
+void
+swapstat(struct memstat *st)
+{
+  st->nswap = swap.nslot;
+  st->swapused = swap.nused;
+  st->nswapout = swap.nout;
+  st->nswapin = swap.nin;
+  st->nzswapin = swap.nzin;
+  st->zinkcycles = swap.nzin ? (uint)(swap.zcycles >> 10) / swap.nzin : 0;
+  st->diskinkcycles = swap.nin > swap.nzin ?
+    (uint)(swap.diskcycles >> 10) / (swap.nin - swap.nzin) : 0;
+  zswapstat(st);
+}
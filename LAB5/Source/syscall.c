@@ -32,15 +32,25 @@ int
 fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
+  uint *w;
   struct proc *curproc = myproc();
 
   if(addr >= curproc->sz)
     return -1;
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
-  for(s = *pp; s < ep; s++){
+  for(s = *pp; s < ep && (uint)s % 4; s++)
     if(*s == 0)
       return s - *pp;
+  // Then look a word at a time for one with a zero byte.
+  // A word that starts below ep is on a page that is mapped.
+  for(w = (uint*)s; (char*)w < ep; w++){
+    if(((*w - 0x01010101) & ~*w & 0x80808080) == 0)
+      continue;
+    for(s = (char*)w; s < ep; s++)
+      if(*s == 0)
+        return s - *pp;
+    return -1;
   }
   return -1;
 }
@@ -59,11 +69,20 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
+  struct vma *v;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (uint)i+size < (uint)i)
+    return -1;
+  if((uint)i >= curproc->sz || (uint)i+size > curproc->sz){
+    // Also fine if it lies within one mapping above sz.
+    if((v = vmalookup(curproc, i)) == 0 || v->start < curproc->sz ||
+       (uint)i+size > v->end)
+      return -1;
+  }
+  if(uvmprefault(curproc, i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -73,13 +92,17 @@ argptr(int n, char **pp, int size)
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
 // between this check and being used by the kernel.)
+// The string stays pinned until the system call returns,
+// since the call may sleep before using it.
 int
 argstr(int n, char **pp)
 {
-  int addr;
+  int addr, len;
   if(argint(n, &addr) < 0)
     return -1;
-  return fetchstr(addr, pp);
+  if((len = fetchstr(addr, pp)) >= 0)
+    uvmpin(myproc(), addr, len + 1);
+  return len;
 }
 
 extern int sys_chdir(void);
@@ -118,6 +141,20 @@ extern int sys_sem_acquire(void);
 extern int sys_sem_release(void);
 
 extern int sys_get_free_pages_count(void);
+extern int sys_lockbench(void);
+extern int sys_lockstat(void);
+extern int sys_get_mem_stats(void);
+extern int sys_get_proc_mem_stats(void);
+extern int sys_sbrklarge(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_msync(void);
+extern int sys_spawn(void);
+extern int sys_vfork(void);
+extern int sys_getpids(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -154,7 +191,34 @@ static int (*syscalls[])(void) = {
 [SYS_sem_init] sys_sem_init,
 [SYS_sem_acquire] sys_sem_acquire,
 [SYS_sem_release] sys_sem_release,
-[SYS_get_free_pages_count] sys_get_free_pages_count
+[SYS_get_free_pages_count] sys_get_free_pages_count,
+[SYS_lockbench] sys_lockbench,
+[SYS_lockstat] sys_lockstat,
+[SYS_get_mem_stats] sys_get_mem_stats,
+[SYS_get_proc_mem_stats] sys_get_proc_mem_stats,
+[SYS_sbrklarge] sys_sbrklarge,
+[SYS_shmget] sys_shmget,
+[SYS_shmat] sys_shmat,
+[SYS_shmdt] sys_shmdt,
+[SYS_mmap] sys_mmap,
+[SYS_munmap] sys_munmap,
+[SYS_msync] sys_msync,
+[SYS_spawn] sys_spawn,
+[SYS_vfork] sys_vfork,
+[SYS_getpids] sys_getpids
+};
+
+static char pinall[NELEM(syscalls)] = {
+[SYS_fork]      1,
+[SYS_exec]      1,
+[SYS_sbrk]      1,
+[SYS_sbrklarge] 1,
+[SYS_shmat]     1,
+[SYS_shmdt]     1,
+[SYS_mmap]      1,
+[SYS_munmap]    1,
+[SYS_msync]     1,
+[SYS_spawn]     1,
 };
 
 void
@@ -165,7 +229,16 @@ syscall(void)
 
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    // Calls that walk or change the caller's page table pin
+    // all of its memory.  The rest only pin the buffers they
+    // are handed, so that a process sleeping in one can still
+    // give up its other pages.
+    if(pinall[num])
+      curproc->pinned++;
     curproc->tf->eax = syscalls[num]();
+    if(pinall[num])
+      curproc->pinned--;
+    uvmunpin(curproc);
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
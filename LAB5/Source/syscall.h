@@ -35,3 +35,17 @@
 #define SYS_sem_release 32
 
 #define SYS_get_free_pages_count 33
+#define SYS_lockbench 34
+#define SYS_lockstat 35
+#define SYS_get_mem_stats 36
+#define SYS_get_proc_mem_stats 37
+#define SYS_sbrklarge 38
+#define SYS_shmget 39
+#define SYS_shmat 40
+#define SYS_shmdt 41
+#define SYS_mmap 42
+#define SYS_munmap 43
+#define SYS_msync 44
+#define SYS_spawn 45
+#define SYS_vfork 46
+#define SYS_getpids 47
@@ -393,19 +393,19 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the path and argv arguments of exec() and spawn().
+static int
+argexec(char **path, char **argv)
 {
-  char *path, *argv[MAXARG];
   int i;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argstr(0, path) < 0 || argint(1, (int*)&uargv) < 0){
     return -1;
   }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -416,9 +416,39 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+
+  if(argexec(&path, argv) < 0)
+    return -1;
   return exec(path, argv);
 }
 
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  int i, *ufds, fds[NOFILE];
+
+  if(argexec(&path, argv) < 0 || argint(2, (int*)&ufds) < 0)
+    return -1;
+  if(ufds == 0)
+    return spawn(path, argv, 0);
+  if(argptr(2, (char**)&ufds, sizeof(fds)) < 0)
+    return -1;
+  for(i = 0; i < NOFILE; i++){
+    fds[i] = ufds[i];
+    if(fds[i] >= NOFILE || (fds[i] >= 0 && myproc()->ofile[fds[i]] == 0))
+      return -1;
+  }
+  return spawn(path, argv, fds);
+}
+
 int
 sys_pipe(void)
 {
@@ -457,3 +487,37 @@ sys_get_file_sectors(void)
   return 0;
 }
 
+
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int off, len, prot, flags;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0 ||
+     argint(3, &prot) < 0 || argint(4, &flags) < 0)
+    return -1;
+  if(off < 0 || len <= 0)
+    return -1;
+  return mmap(f, off, len, prot, flags);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+int
+sys_msync(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return msync(addr, len);
+}
@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "memstat.h"
+#include "pmemstat.h"
 
 int
 sys_fork(void)
@@ -13,6 +15,12 @@ sys_fork(void)
   return fork();
 }
 
+int
+sys_vfork(void)
+{
+  return vfork();
+}
+
 int
 sys_exit(void)
 {
@@ -56,6 +64,18 @@ sys_sbrk(void)
   return addr;
 }
 
+// Like sbrk, but the new memory is mapped with large pages,
+// allocated up front, starting at a 4MB boundary.
+int
+sys_sbrklarge(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return growlarge(n);
+}
+
 int
 sys_sleep(void)
 {
@@ -106,7 +126,7 @@ int sys_get_parent_pid(void)
   return p->pid;
 }
 
-void sys_set_process_parent(void)
+int sys_set_process_parent(void)
 {
   int pid = myproc()->tf->ebx;
   cprintf("sys_set_process_parent for process %d\n", pid);
@@ -166,6 +186,94 @@ int sys_sem_release(void){
 
 
 int sys_get_free_pages_count(void) {
-  get_free_pages_count();
+  return get_free_pages_count();
+}
+
+int
+sys_lockbench(void)
+{
+  int nticks;
+
+  if(argint(0, &nticks) < 0 || nticks <= 0)
+    return -1;
+  return lockbench(nticks);
+}
+
+int
+sys_lockstat(void)
+{
+  int n, reset;
+
+  if(argint(0, &n) < 0 || argint(1, &reset) < 0)
+    return -1;
+  return lockstat(n, reset);
+}
+
+int
+sys_get_mem_stats(void)
+{
+  struct memstat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  getmemstat(st);
   return 0;
 }
+
+int
+sys_get_proc_mem_stats(void)
+{
+  int pid;
+  struct pmemstat *st;
+
+  if(argint(0, &pid) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  return procmemstat(pid, st);
+}
+
+int
+sys_getpids(void)
+{
+  int *upids, n, pids[NPROC];
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NPROC)
+    n = NPROC;
+  if(argptr(0, (void*)&upids, n*sizeof(int)) < 0)
+    return -1;
+  // Copy out after getpids() has dropped ptable.lock.
+  n = getpids(pids, n);
+  memmove(upids, pids, n*sizeof(int));
+  return n;
+}
+
+int
+sys_shmget(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  return shmget(key, size);
+}
+
+int
+sys_shmat(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmat(id);
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmdt(addr);
+}
@@ -0,0 +1,66 @@
+// TLB reach benchmark.
+// Touches one word in every 4KB page of an mb-megabyte
+// region, first mapped with 4KB pages (sbrk) and then with
+// 4MB pages (sbrklarge), and prints the cycles per access.
+// Once the region is larger than the TLB covers with small
+// pages, every small-page access is a TLB miss.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+#define PGSIZE 4096
+
+static uint
+timepass(char *buf, int npages, int passes)
+{
+  uint64 t0;
+  uint total;
+  volatile int sum;
+  int i, p;
+
+  // Fault everything in first, so only TLB misses are timed.
+  for(i = 0; i < npages; i++)
+    buf[i * PGSIZE] = 1;
+
+  total = 0;
+  sum = 0;
+  for(p = 0; p < passes; p++){
+    t0 = rdtsc();
+    for(i = 0; i < npages; i++)
+      sum += buf[i * PGSIZE];
+    total += (uint)(rdtsc() - t0) / npages;
+  }
+  return total / passes;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb, passes, npages;
+  char *small, *large;
+
+  mb = argc > 1 ? atoi(argv[1]) : 16;
+  passes = argc > 2 ? atoi(argv[2]) : 10;
+  if(mb < 4 || passes < 1){
+    printf(2, "usage: tlbbench [mb >= 4] [passes]\n");
+    exit();
+  }
+  npages = mb * (1024*1024 / PGSIZE);
+
+  if((small = sbrk(mb * 1024*1024)) == (char*)-1){
+    printf(2, "tlbbench: sbrk failed\n");
+    exit();
+  }
+  printf(1, "4KB pages: %d cycles per access\n",
+         timepass(small, npages, passes));
+
+  if((large = sbrklarge(mb * 1024*1024)) == (char*)-1){
+    printf(2, "tlbbench: sbrklarge failed\n");
+    exit();
+  }
+  printf(1, "4MB pages: %d cycles per access\n",
+         timepass(large, npages, passes));
+  exit();
+}
@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct memstat;
+struct pmemstat;
 
 // system calls
 int fork(void);
@@ -26,7 +28,7 @@ int uptime(void);
 int calculate_sum_of_digits(void);
 int get_parent_pid(void);
 int get_file_sectors(int fd, int sectors[]);
-void set_process_parent(void);
+int set_process_parent(void);
 
 void change_process_queue(int pid, int dest_q);
 void set_hrrn_priority(int pid, int new_priority);
@@ -37,7 +39,21 @@ int sem_init(int i, int j);
 int sem_acquire(int i);
 int sem_release(int i);
 
-void get_free_pages_count(void);
+int get_free_pages_count(void);
+int lockbench(int nticks);
+int lockstat(int n, int reset);
+int get_mem_stats(struct memstat*);
+int get_proc_mem_stats(int, struct pmemstat*);
+char* sbrklarge(int);
+int shmget(int, int);
+char* shmat(int);
+int shmdt(char*);
+char* mmap(int, int, int, int, int);
+int munmap(char*, int);
+int msync(char*, int);
+int spawn(char*, char**, int*);
+int vfork(void);
+int getpids(int*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
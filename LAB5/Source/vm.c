@@ -6,6 +6,9 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "memstat.h"
+#include "pmemstat.h"
+#include "mman.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -21,17 +24,27 @@ seginit(void)
   // Cannot share a CODE descriptor for both kernel and user
   // because it would have to have DPL_USR, but the CPU forbids
   // an interrupt from CPL=0 to DPL=3.
-  c = &cpus[cpuid()];
+  c = apiccpu();
   c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, 0);
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+
+  // Map cpu and proc -- these are private per cpu.
+  c->gdt[SEG_KCPU] = SEG(STA_W, &c->self, 8, 0);
+
   lgdt(c->gdt, sizeof(c->gdt));
+  loadgs(SEG_KCPU << 3);
+
+  // Initialize cpu-local storage.
+  c->self = c;
+  c->proc = 0;
 }
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages.  Returns 0 if va is
+// in a large page, which has no PTE; see islarge().
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -39,13 +52,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return 0;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed(MEM_PGTBL)) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -57,7 +71,7 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
-static int
+int
 mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 {
   char *a, *last;
@@ -79,6 +93,36 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Is va mapped by a large page in pgdir?
+static int
+islarge(pde_t *pgdir, uint va)
+{
+  return (pgdir[PDX(va)] & (PTE_P|PTE_PS)) == (PTE_P|PTE_PS);
+}
+
+// Like mappages(), but use a large page wherever va and pa
+// are both LPGSIZE-aligned and enough of the range is left.
+// For the kernel mappings, which are never unmapped.
+static int
+mapkernel(pde_t *pgdir, uint va, uint size, uint pa, int perm)
+{
+  while(size > 0){
+    if(va % LPGSIZE == 0 && pa % LPGSIZE == 0 && size >= LPGSIZE){
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+      va += LPGSIZE;
+      pa += LPGSIZE;
+      size -= LPGSIZE;
+    } else {
+      if(mappages(pgdir, (void*)va, PGSIZE, pa, perm) < 0)
+        return -1;
+      va += PGSIZE;
+      pa += PGSIZE;
+      size -= PGSIZE;
+    }
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -92,13 +136,20 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, as
+// found at boot) (directly addressable from end..P2V(phystop)).
+//
+// The kernel half never changes after boot, so kvmalloc() builds
+// its page tables once, in kpgdir, and setupkvm() just copies
+// kpgdir's page directory entries above KERNBASE: every page
+// table shares the same kernel page-table pages.  Above the
+// first 4MB, whose permissions are mixed, the direct map and
+// the device space use large pages.
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -110,7 +161,7 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
+ { (void*)data,     V2P(data),     0,         PTE_W}, // kern data+memory
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
@@ -119,28 +170,31 @@ pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed(MEM_PGTBL)) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes.  Its kernel page tables are
+// the ones every other page table uses.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if((kpgdir = (pde_t*)kalloc_zeroed(MEM_PGTBL)) == 0)
+    panic("kvmalloc");
+  if (P2V(phystop) > (void*)DEVSPACE)
+    panic("phystop too high");
+  kmap[2].phys_end = phystop;  // Known only now
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkernel(kpgdir, (uint)k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -186,36 +240,11 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed(MEM_USER);
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -231,13 +260,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed(MEM_USER);
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -248,10 +276,33 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Replace the large page at va with a page table mapping
+// its 4KB pages, so that part of it can be unmapped.
+// Returns -1 if out of memory.
+static int
+splitlarge(pde_t *pgdir, uint va)
+{
+  pte_t *pgtab;
+  pde_t pde;
+  int i;
+
+  pde = pgdir[PDX(va)];
+  if((pgtab = (pte_t*)kalloc(MEM_PGTBL)) == 0)
+    return -1;
+  ksplit_pages(P2V(PTE_ADDR(pde)), LPGORDER);
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = (PTE_ADDR(pde) + i*PGSIZE) | (PTE_FLAGS(pde) & ~PTE_PS);
+  pgdir[PDX(va)] = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+  if(myproc() && myproc()->pgdir == pgdir)
+    lcr3(V2P(pgdir));
+  return 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or 0 if a large
+// page had to be split and there was no memory for that.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
@@ -262,7 +313,21 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
     return oldsz;
 
   a = PGROUNDUP(newsz);
+  // Shrinking into the middle of a large page: split it, so
+  // that its tail is freed and grows back zero-filled.
+  if(a < oldsz && a % LPGSIZE && islarge(pgdir, a) &&
+     splitlarge(pgdir, a) < 0)
+    return 0;
   for(; a  < oldsz; a += PGSIZE){
+    if(islarge(pgdir, a)){
+      // Only free a large page once all of it is gone.
+      if(a % LPGSIZE == 0){
+        kfree_pages(P2V(PTE_ADDR(pgdir[PDX(a)])), LPGORDER);
+        pgdir[PDX(a)] = 0;
+      }
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -273,13 +338,44 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+    } else if(*pte & PTE_SWAP){
+      swapput(PTE_ADDR(*pte) / PGSIZE);
+      *pte = 0;
     }
   }
   return newsz;
 }
 
+// Grow process from oldsz to at least newsz with large pages,
+// starting at the first LPGSIZE boundary at or above oldsz.
+// The pages are allocated and zeroed now.  Returns the new
+// size, or 0 on error.
+int
+allocuvmlarge(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  char *mem;
+  uint a, end;
+
+  a = LPGROUNDUP(oldsz);
+  end = LPGROUNDUP(newsz);
+  if(newsz <= oldsz || a < oldsz || end < newsz || end > MMAPBASE)
+    return 0;
+  for(; a < end; a += LPGSIZE){
+    if((mem = kalloc_pages(LPGORDER, MEM_USER)) == 0){
+      deallocuvm(pgdir, a, oldsz);
+      return 0;
+    }
+    memset(mem, 0, LPGSIZE);
+    // A page table left behind by an earlier shrink is empty.
+    if(pgdir[PDX(a)] & PTE_P)
+      kfree(P2V(PTE_ADDR(pgdir[PDX(a)])));
+    pgdir[PDX(a)] = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+  }
+  return end;
+}
+
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part belongs to kpgdir.
 void
 freevm(pde_t *pgdir)
 {
@@ -288,7 +384,7 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -310,40 +406,545 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Copy the pages of [start, end) in pgdir into d, as fork()
+// does: pages are shared copy-on-write.  The caller must
+// flush pgdir's TLB afterwards, since its pages lose PTE_W.
+int
+uvmcopy(pde_t *d, pde_t *pgdir, uint start, uint end)
+{
+  pte_t *pte, *dpte;
+  uint pa, i, flags;
+  char *mem;
+
+  for(i = start; i < end; i += PGSIZE){
+    if(islarge(pgdir, i)){
+      // Large pages are not shared: copy all 4MB now.
+      if((mem = kalloc_pages(LPGORDER, MEM_USER)) == 0)
+        return -1;
+      memmove(mem, P2V(PTE_ADDR(pgdir[PDX(i)])), LPGSIZE);
+      d[PDX(i)] = V2P(mem) | PTE_FLAGS(pgdir[PDX(i)]);
+      i += LPGSIZE - PGSIZE;
+      continue;
+    }
+    // Pages nobody has touched yet stay lazy in the child.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      // Both read their own copy back in from the slot.
+      if((dpte = walkpgdir(d, (void*)i, 1)) == 0)
+        return -1;
+      *dpte = *pte;
+      swapdup(PTE_ADDR(*pte) / PGSIZE);
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    pa = PTE_ADDR(*pte);
+    if(!(*pte & PTE_U)){
+      // The stack guard page: the kernel may still write
+      // it, so it can't fault, so copy it now.
+      if((mem = kalloc(MEM_USER)) == 0)
+        return -1;
+      memmove(mem, (char*)P2V(pa), PGSIZE);
+      pa = V2P(mem);
+    } else {
+      // Share the page; whoever writes it first gets a copy.
+      if(*pte & PTE_W)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      kdup(P2V(pa));
+    }
+    flags = PTE_FLAGS(*pte);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0) {
+      kfree(P2V(pa));
+      return -1;
+    }
+  }
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
 // of it for a child.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
+
+  if((d = setupkvm()) == 0)
+    return 0;
+  if(uvmcopy(d, pgdir, 0, sz) < 0){
+    lcr3(V2P(pgdir));
+    freevm(d);
+    return 0;
+  }
+  // The parent's mappings just lost PTE_W.
+  lcr3(V2P(pgdir));
+  return d;
+}
+
+// Give pgdir its own writable copy of the copy-on-write
+// page at va.  If no one else maps the page any more, it is
+// just made writable again.  Returns 0 on success, -1 if va
+// is not a copy-on-write page or memory ran out.
+int
+cowpage(pde_t *pgdir, uint va)
+{
   pte_t *pte;
-  uint pa, i, flags;
+  char *old, *mem;
+
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  old = P2V(PTE_ADDR(*pte));
+  if(krefcount(old) == 1){
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+  } else {
+    if((mem = kalloc(MEM_USER)) == 0)
+      return -1;
+    memmove(mem, old, PGSIZE);
+    *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    kfree(old);
+  }
+  invlpg((void*)va);
+  return 0;
+}
+
+// Read the page at va of mapping v into a new page.
+// May sleep, so the caller must not hold a spinlock.
+static char*
+vmapage(struct vma *v, uint va)
+{
   char *mem;
+  uint off, n;
 
-  if((d = setupkvm()) == 0)
+  if((mem = kalloc(MEM_USER)) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
+  off = va - v->start;
+  n = v->filesz - off;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  else
+    memset(mem + n, 0, PGSIZE - n);
+  ilock(v->ip);
+  if(readi(v->ip, mem, v->off + off, n) != n){
+    iunlock(v->ip);
+    kfree(mem);
+    return 0;
+  }
+  iunlock(v->ip);
+  return mem;
+}
+
+// Free pages uvmfault() tries to keep, swapping out if need be.
+#define SWAPLOW 16
+
+static int dofault(struct proc*, uint, uint);
+
+// Handle a page fault at user address va in process p,
+// which must be the current process.  err is the hardware
+// error code.  Returns 0 if the faulting access can be retried.
+int
+uvmfault(struct proc *p, uint va, uint err)
+{
+  int r;
+
+  if(va >= KERNBASE)
+    return -1;
+  // Make room first, before holding on to any of p's PTEs:
+  // unless p is pinned, its own pages may be swapped out.
+  if(mycpu()->ncli == 0)
+    while(get_free_pages_count() < SWAPLOW && swapout() == 0)
+      ;
+  p->pinned++;
+  r = dofault(p, PGROUNDDOWN(va), err);
+  p->pinned--;
+  return r;
+}
+
+static int
+dofault(struct proc *p, uint va, uint err)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_SWAP)){
+    // Read it back in, which sleeps.  A write to a
+    // copy-on-write page will fault again.
+    if(mycpu()->ncli > 0 || (mem = kalloc(MEM_USER)) == 0)
+      return -1;
+    if(swapin(PTE_ADDR(*pte) / PGSIZE, mem))
+      p->nmajflt++;
+    else
+      p->nminflt++;
+    *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_P;
+    return 0;
+  }
+  if((err & (FEC_P|FEC_WR)) == (FEC_P|FEC_WR)){
+    if(cowpage(p->pgdir, va) < 0)
+      return -1;
+    p->ncow++;
+    return 0;
+  }
+  if(err & FEC_P)
+    return -1;
+  // A vfork() child uses its parent's mappings as well.
+  v = vmalookup(p->lender ? p->lender : p, va);
+  if(v && v->type == VMA_MMAP)
+    return mmapfault(p, v, va);
+  if(va < p->sz){
+    if(v && v->type == VMA_FILE){
+      // Program text and data that exec() left on disk.
+      // Reading it sleeps, which is only safe without spinlocks.
+      if(mycpu()->ncli > 0 || (mem = vmapage(v, va)) == 0)
+        return -1;
+      p->nmajflt++;
+    } else if((mem = kalloc_zeroed(MEM_USER)) == 0){
+      // Heap that growproc() reserved, or bss: zero fill.
+      return -1;
+    } else {
+      p->nminflt++;
+    }
+    if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       kfree(mem);
-      goto bad;
+      return -1;
     }
+    return 0;
   }
-  return d;
+  return -1;
+}
+
+// Fault in any missing pages of [va, va+len) in process p,
+// and copy any copy-on-write ones, so that the kernel can
+// read and write the range without taking a page fault that
+// might fail.  Returns -1 if out of memory.
+int
+uvmprefault(struct proc *p, uint va, uint len)
+{
+  pte_t *pte;
+  uint a;
+
+  uvmpin(p, va, len);
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    if(islarge(p->pgdir, a))
+      continue;
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if((pte == 0 || !(*pte & PTE_P)) && uvmfault(p, a, 0) < 0)
+      return -1;
+    // A page read back from swap may be copy-on-write too.
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(*pte & PTE_COW){
+      if(cowpage(p->pgdir, a) < 0)
+        return -1;
+      p->ncow++;
+    }
+  }
+  return 0;
+}
+
+// Pin [va, va+len) in the current process p until its system
+// call returns: swapvictim() and ksmidle() leave those pages
+// alone, since the kernel may use them while holding a
+// spinlock, where a page fault can't be served.  System calls
+// that use the page table itself pin all of p (see syscall()).
+void
+uvmpin(struct proc *p, uint va, uint len)
+{
+  if(p->npin < NPIN){
+    p->pin[p->npin].start = PGROUNDDOWN(va);
+    p->pin[p->npin].end = va + len;
+    p->npin++;
+  } else if(!p->pinover){
+    p->pinover = 1;
+    p->pinned++;
+  }
+}
+
+// Drop the pins of the system call that is returning.
+void
+uvmunpin(struct proc *p)
+{
+  p->npin = 0;
+  if(p->pinover){
+    p->pinover = 0;
+    p->pinned--;
+  }
+}
+
+static int
+ispinned(struct proc *p, uint va)
+{
+  int i;
+
+  for(i = 0; i < p->npin; i++)
+    if(va >= p->pin[i].start && va < p->pin[i].end)
+      return 1;
+  return 0;
+}
+
+// The mapping in process p that contains va, or 0.
+struct vma*
+vmalookup(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->type && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Drop the file and segment references held by the mappings
+// in vma, and free the slots.  The pages themselves go with
+// the page table, pgdir; dirty pages of shared file mappings
+// are written back first, unless pgdir is 0.
+void
+vmarelease(pde_t *pgdir, struct vma *vma)
+{
+  struct vma *v;
+  int op;
+
+  if(pgdir)
+    for(v = vma; v < &vma[NVMA]; v++)
+      if(v->type == VMA_MMAP)
+        mmapsync(pgdir, v, v->start, v->end);
+
+  op = 0;
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(v->type == VMA_FILE || v->type == VMA_MMAP){
+      if(!op){
+        begin_op();
+        op = 1;
+      }
+      iput(v->ip);
+    } else if(v->type == VMA_SHM){
+      shmput(v->shmid);
+    }
+    memset(v, 0, sizeof(*v));
+  }
+  if(op)
+    end_op();
+}
 
-bad:
-  freevm(d);
+// Copy p's mappings to np, for fork().  np's page table
+// must already hold a copy of p's memory below sz; the pages
+// of mappings above it are shared or copied into it here.
+int
+vmadup(struct proc *np, struct proc *p)
+{
+  int i, r;
+  struct vma *v;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    r = 0;
+    if(v->type == VMA_SHM || (v->type == VMA_MMAP && v->flags == MAP_SHARED))
+      r = uvmshare(np->pgdir, p->pgdir, v->start, v->end);
+    else if(v->type == VMA_MMAP){
+      r = uvmcopy(np->pgdir, p->pgdir, v->start, v->end);
+      lcr3(V2P(p->pgdir));
+    }
+    if(r < 0)
+      return -1;
+    np->vma[i] = *v;
+    if(v->type == VMA_FILE || v->type == VMA_MMAP)
+      idup(v->ip);
+    else if(v->type == VMA_SHM)
+      shmdup(v->shmid);
+  }
   return 0;
 }
 
+// Find a free range of len bytes for a new mapping in p,
+// between MMAPBASE and KERNBASE.  Returns 0 if there is none.
+uint
+vmaspace(struct proc *p, uint len)
+{
+  struct vma *v;
+  uint a;
+
+  a = MMAPBASE;
+  for(v = p->vma; v < &p->vma[NVMA]; ){
+    if(a + len > KERNBASE || a + len < a)
+      return 0;
+    if(v->type && v->start < a + len && a < v->end){
+      a = v->end;
+      v = p->vma;
+    } else {
+      v++;
+    }
+  }
+  return a;
+}
+
+// Cut the mappings in vma down to end below sz, so that
+// memory grown back there later is zero-filled.
+void
+vmatrim(struct vma *vma, uint sz)
+{
+  struct vma *v;
+
+  sz = PGROUNDUP(sz);
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(v->type == VMA_FILE && v->end > sz)
+      v->end = v->start > sz ? v->start : sz;
+  }
+}
+
+// Count the pages of [0, sz) that are mapped in pgdir.
+void
+uvmstat(pde_t *pgdir, uint sz, struct pmemstat *st)
+{
+  pte_t *pte;
+  uint a, i;
+
+  memset(st, 0, sizeof(*st));
+  st->sz = sz;
+  for(a = 0; a < sz; a += PGSIZE){
+    if(islarge(pgdir, a)){
+      st->resident++;
+      continue;
+    }
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_P){
+      st->resident++;
+      if(krefcount(P2V(PTE_ADDR(*pte))) > 1)
+        st->shared++;
+    } else if(*pte & PTE_SWAP)
+      st->swapped++;
+  }
+  st->reserved = PGROUNDUP(sz) / PGSIZE - st->resident - st->swapped;
+
+  // The page directory, and the page tables of the user
+  // half; the kernel half uses large pages only.
+  st->ptpages = 1;
+  for(i = 0; i < PDX(KERNBASE); i++)
+    if((pgdir[i] & (PTE_P|PTE_PS)) == PTE_P)
+      st->ptpages++;
+}
+
+// Advance the clock hand *va over the user pages of [*va, sz)
+// of p, clearing PTE_A on pages that have it.  At the first
+// page without it, make the PTE name swap slot instead, and
+// return the page.  Returns 0 if *va reaches sz.  Large
+// pages, pinned pages, pages mapped elsewhere too, and the
+// stack guard page are passed over.  Caller holds ptable.lock.
+char*
+uvmevict(struct proc *p, uint *va, int slot)
+{
+  pde_t *pgdir;
+  pte_t *pte;
+  char *pg;
+  uint a;
+  int cur;
+
+  pgdir = p->pgdir;
+  cur = myproc() && myproc()->pgdir == pgdir;
+  for(a = *va; a < p->sz; a += PGSIZE){
+    if(islarge(pgdir, a) || (pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      if(cur)
+        invlpg((void*)a);
+      continue;
+    }
+    pg = P2V(PTE_ADDR(*pte));
+    if(krefcount(pg) != 1 || ispinned(p, a))
+      continue;
+    *pte = slot*PGSIZE | (PTE_FLAGS(*pte) & ~(PTE_P|PTE_D)) | PTE_SWAP;
+    if(cur)
+      invlpg((void*)a);
+    *va = a + PGSIZE;
+    return pg;
+  }
+  *va = a;
+  return 0;
+}
+
+// Offer up to n user pages of [*va, sz) of p to ksmmerge(),
+// moving *va past them, and map the pages it returns in
+// their place.  Returns how many of the n are left, which is
+// nonzero only if *va reached sz.  Only private pages are
+// offered, and not the buffers of a system call in progress,
+// which the kernel may write without expecting a fault.
+// Caller holds ptable.lock.
+int
+uvmmerge(struct proc *p, uint *va, int n)
+{
+  pde_t *pgdir;
+  pte_t *pte;
+  char *pg, *mem;
+  uint a;
+
+  pgdir = p->pgdir;
+  for(a = *va; a < p->sz && n > 0; a += PGSIZE){
+    if(islarge(pgdir, a) || (pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U) ||
+       !(*pte & (PTE_W|PTE_COW)))
+      continue;
+    pg = P2V(PTE_ADDR(*pte));
+    if(((*pte & PTE_W) && krefcount(pg) != 1) || ispinned(p, a))
+      continue;
+    n--;
+    if((mem = ksmmerge(pg)) == 0)
+      continue;
+    *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_W) | PTE_COW;
+    kfree(pg);
+  }
+  *va = a;
+  return n;
+}
+
+// Map the pages of [start, end) in pgdir into d as well,
+// writable by both: the pages are shared, not copied.
+int
+uvmshare(pde_t *d, pde_t *pgdir, uint start, uint end)
+{
+  pte_t *pte;
+  uint a, pa;
+
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    pa = PTE_ADDR(*pte);
+    if(mappages(d, (char*)a, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
+      return -1;
+    kdup(P2V(pa));
+  }
+  return 0;
+}
+
+// If the page at va in pgdir has been written since the
+// last call, clear its PTE_D and return it with a reference
+// for the caller, to be dropped with kfree().  Otherwise 0.
+char*
+uvmdirty(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *pg;
+
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+    return 0;
+  *pte &= ~PTE_D;
+  invlpg((void*)va);
+  pg = P2V(PTE_ADDR(*pte));
+  kdup(pg);
+  return pg;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -351,8 +952,10 @@ uva2ka(pde_t *pgdir, char *uva)
 {
   pte_t *pte;
 
+  if(islarge(pgdir, (uint)uva))
+    return (char*)P2V(PTE_ADDR(pgdir[PDX(uva)])) + ((uint)uva % LPGSIZE);
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -361,26 +964,45 @@ uva2ka(pde_t *pgdir, char *uva)
 
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
-// uva2ka ensures this only works for PTE_U pages.
+// This only works for PTE_U pages, as with uva2ka(), but
+// walks the page table just once per page.
+// Copy-on-write pages are copied first, as a write fault would.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
-  char *buf, *pa0;
-  uint n, va0;
+  char *buf, *pa;
+  uint n, off;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
-    va0 = (uint)PGROUNDDOWN(va);
-    pa0 = uva2ka(pgdir, (char*)va0);
-    if(pa0 == 0)
-      return -1;
-    n = PGSIZE - (va - va0);
+    if(pgdir[PDX(va)] & PTE_PS){
+      if((pgdir[PDX(va)] & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+        return -1;
+      off = va % LPGSIZE;
+      pa = (char*)P2V(PTE_ADDR(pgdir[PDX(va)])) + off;
+      n = LPGSIZE - off;
+    } else {
+      if((pte = walkpgdir(pgdir, (char*)va, 0)) == 0)
+        return -1;
+      if(*pte & PTE_COW){
+        if(cowpage(pgdir, PGROUNDDOWN(va)) < 0)
+          return -1;
+        if(myproc() && myproc()->pgdir == pgdir)
+          myproc()->ncow++;
+      }
+      if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+        return -1;
+      off = va % PGSIZE;
+      pa = (char*)P2V(PTE_ADDR(*pte)) + off;
+      n = PGSIZE - off;
+    }
     if(n > len)
       n = len;
-    memmove(pa0 + (va - va0), buf, n);
+    memmove(pa, buf, n);
     len -= n;
     buf += n;
-    va = va0 + PGSIZE;
+    va += n;
   }
   return 0;
 }
@@ -0,0 +1,222 @@
+// Compressed swap pool.
+//
+// swapout() first tries to keep a page compressed in memory,
+// under its swap slot, and only writes it to disk if the page
+// compresses too poorly or the pool is full.  A fault on such
+// a page then costs a decompression instead of a disk read.
+// The pool is a few slab caches of size classes, and may grow
+// to ZPOOLPAGES pages.
+//
+// The compressor is a small LZ77: the output is a sequence
+// of items, each starting with a byte b.  If b < 0x80, b+1
+// literal bytes follow.  Otherwise the item is a match of
+// (b & 0x7f) + MINMATCH bytes copied from the given 16-bit
+// distance back in the output.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "slab.h"
+#include "memstat.h"
+
+#define MINMATCH  3
+#define MAXMATCH  (0x7f + MINMATCH)
+#define MAXLIT    0x80
+#define LZHASH(p) ((((p)[0] << 8) ^ ((p)[1] << 4) ^ (p)[2]) & (NLZHASH-1))
+#define NLZHASH   1024
+
+#define NZCLASS 7
+static uint zclass[NZCLASS] = { 64, 128, 256, 512, 1024, 1336, 1984 };
+#define ZMAX 1984   // Pages that compress to more go to disk
+
+#define NSLOT (SWAPSIZE / (PGSIZE / BSIZE))
+
+struct {
+  struct spinlock lock;
+  struct slabcache cache[NZCLASS];
+  char *data[NSLOT];       // Compressed contents of each slot, or 0
+  ushort len[NSLOT];
+  ushort lzhash[NLZHASH];  // Last position+1 of each 3-byte hash
+  uchar buf[ZMAX];         // Output of lzcompress()
+  uint nstored;
+  uint nbytes;
+  uint nrejected;
+} zswap;
+
+// Append the literals src[lit..end) to dst at *op.
+// Returns -1 if they don't fit in max bytes.
+static int
+lzliterals(uchar *src, int lit, int end, uchar *dst, int *op, int max)
+{
+  int n;
+
+  while(lit < end){
+    n = end - lit;
+    if(n > MAXLIT)
+      n = MAXLIT;
+    if(*op + 1 + n > max)
+      return -1;
+    dst[(*op)++] = n - 1;
+    memmove(dst + *op, src + lit, n);
+    *op += n;
+    lit += n;
+  }
+  return 0;
+}
+
+// Compress the page src into dst, which holds max bytes.
+// Returns the compressed length, or -1 if it won't fit.
+// Caller holds zswap.lock, for lzhash.
+static int
+lzcompress(uchar *src, uchar *dst, int max)
+{
+  int ip, op, lit, cand, len, h;
+
+  memset(zswap.lzhash, 0, sizeof(zswap.lzhash));
+  ip = op = lit = 0;
+  while(ip <= PGSIZE - MINMATCH){
+    h = LZHASH(src + ip);
+    cand = zswap.lzhash[h] - 1;
+    zswap.lzhash[h] = ip + 1;
+    if(cand < 0 || src[cand] != src[ip] || src[cand+1] != src[ip+1] ||
+       src[cand+2] != src[ip+2]){
+      ip++;
+      continue;
+    }
+    len = MINMATCH;
+    while(ip + len < PGSIZE && len < MAXMATCH && src[cand+len] == src[ip+len])
+      len++;
+    if(lzliterals(src, lit, ip, dst, &op, max) < 0 || op + 3 > max)
+      return -1;
+    dst[op++] = 0x80 | (len - MINMATCH);
+    dst[op++] = (ip - cand) & 0xff;
+    dst[op++] = (ip - cand) >> 8;
+    ip += len;
+    lit = ip;
+  }
+  if(lzliterals(src, lit, PGSIZE, dst, &op, max) < 0)
+    return -1;
+  return op;
+}
+
+static void
+lzdecompress(uchar *src, int n, uchar *dst)
+{
+  uchar *end, *from;
+  int len;
+
+  end = src + n;
+  while(src < end){
+    if(*src < 0x80){
+      len = *src++ + 1;
+      memmove(dst, src, len);
+      src += len;
+      dst += len;
+    } else {
+      len = (*src & 0x7f) + MINMATCH;
+      from = dst - (src[1] | (src[2] << 8));
+      src += 3;
+      // The copy may overlap itself, so go a byte at a time.
+      while(len-- > 0)
+        *dst++ = *from++;
+    }
+  }
+}
+
+void
+zswapinit(void)
+{
+  int i;
+
+  initlock(&zswap.lock, "zswap");
+  for(i = 0; i < NZCLASS; i++)
+    slabinit(&zswap.cache[i], "zswap", zclass[i], MEM_ZPOOL);
+}
+
+static int
+zpoolpages(void)
+{
+  int i, n;
+
+  n = 0;
+  for(i = 0; i < NZCLASS; i++)
+    n += zswap.cache[i].nslabs;
+  return n;
+}
+
+static int
+zclassof(int len)
+{
+  int i;
+
+  for(i = 0; zclass[i] < len; i++)
+    ;
+  return i;
+}
+
+// Keep a compressed copy of the page pg for slot.
+// Returns -1 if the page must be written to disk instead.
+int
+zstore(int slot, char *pg)
+{
+  char *obj;
+  int len;
+
+  acquire(&zswap.lock);
+  if(zpoolpages() >= ZPOOLPAGES ||
+     (len = lzcompress((uchar*)pg, zswap.buf, ZMAX)) < 0 ||
+     (obj = slaballoc(&zswap.cache[zclassof(len)])) == 0){
+    zswap.nrejected++;
+    release(&zswap.lock);
+    return -1;
+  }
+  memmove(obj, zswap.buf, len);
+  zswap.data[slot] = obj;
+  zswap.len[slot] = len;
+  zswap.nstored++;
+  zswap.nbytes += len;
+  release(&zswap.lock);
+  return 0;
+}
+
+// Decompress slot into the page mem, if it is in the pool.
+// The pool keeps it until zfree(), since a forked PTE may
+// name the slot too.  Returns -1 if the slot is on disk.
+int
+zload(int slot, char *mem)
+{
+  acquire(&zswap.lock);
+  if(zswap.data[slot] == 0){
+    release(&zswap.lock);
+    return -1;
+  }
+  lzdecompress((uchar*)zswap.data[slot], zswap.len[slot], (uchar*)mem);
+  release(&zswap.lock);
+  return 0;
+}
+
+// Slot is no longer in use.
+void
+zfree(int slot)
+{
+  acquire(&zswap.lock);
+  if(zswap.data[slot]){
+    slabfree(&zswap.cache[zclassof(zswap.len[slot])], zswap.data[slot]);
+    zswap.data[slot] = 0;
+    zswap.nstored--;
+    zswap.nbytes -= zswap.len[slot];
+  }
+  release(&zswap.lock);
+}
+
+void
+zswapstat(struct memstat *st)
+{
+  st->zpoolpages = zpoolpages();
+  st->zstored = zswap.nstored;
+  st->zbytes = zswap.nbytes;
+  st->zrejected = zswap.nrejected;
+}